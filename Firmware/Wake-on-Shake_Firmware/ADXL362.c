@@ -17,60 +17,203 @@ check out xl362.h, which was provided by Analog Devices.
 #include "xl362.h"
 #include "eeprom.h"
 #include "wake-on-shake.h"
+#include "energy.h"
+#include "clock.h"
 
-// ADXLConfig() sets all the necessary registers on the ADXL362 up to support
-//   the wake-on-shake type application.
-void ADXLConfig(void)
+extern config_t		config;		// See Wake-on-Shake.cpp
+extern energyDelta_t	energy;		// See energy.c
+
+// Select the ADXL362, and send it a command and a register address. The
+//   bursts run at 4MHz; see clock.c. ADXLEnd() finishes up; len is the
+//   number of bytes moved, for the energy counters.
+static void ADXLStart(uint8_t command, uint8_t addr)
+{
+	clockFast();
+	PORTB &= ~(1<<PB4);
+	spiXfer(command);
+	spiXfer(addr);
+}
+
+static void ADXLEnd(uint8_t len)
 {
-	// Activity threshold level (0x20)-
-	//   Defaults to 150mg; user can change this.
-	ADXLWriteByte((uint8_t)XL362_THRESH_ACTH, EEPROMReadByte(ATHRESH));
-	ADXLWriteByte((uint8_t)XL362_THRESH_ACTL, EEPROMReadByte(ATHRESH + 1));
-	// Inactivity threshold level (0x23)-
-	//   Written to 50 to give a 50mg sleep detection level
-	ADXLWriteByte((uint8_t)XL362_THRESH_INACTH, EEPROMReadByte(ITHRESH));
-	ADXLWriteByte((uint8_t)XL362_THRESH_INACTL, EEPROMReadByte(ITHRESH+1));
-	// Inactivity timer (0x25)-
-	//   Written to 15; wait 15 samples (~2.5 seconds) before going back
-	//   to sleep.
-	ADXLWriteByte((uint8_t)XL362_TIME_INACTH, EEPROMReadByte(ITIME));
-	ADXLWriteByte((uint8_t)XL362_TIME_INACTL, EEPROMReadByte(ITIME+1));	
-	// Activity/Inactivity control register (0x27)-
+	PORTB |= (1<<PB4);
+	clockSlow();
+	energyAdd(spiBytes, len);
+}
+
+// Registers 0x20 (THRESH_ACTL) through 0x2D (POWER_CTL) all come from the
+//   config block, or are constants. Nothing is sent when a setting changes;
+//   ADXLMarkDirty() just flags it, and ADXLSync() writes the whole lot out
+//   in one burst when we go to sleep. Going to sleep after a wake where
+//   nobody touched anything costs one register read instead of a full
+//   reconfiguration. The whole block is 14 bytes, so there's no point in
+//   keeping track of which ones changed.
+//   With FEATURE_ADXL_VERIFY, if verify is TRUE, and nothing's been flagged,
+//   POWER_CTL gets read back; if it doesn't match (the ADXL362 browned out,
+//   say), everything is rewritten anyway. POWER_CTL is at the top of the block, so it's always
+//   written last, as the datasheet recommends. FILTER_CTL may only be
+//   changed in standby, so stop measuring first.
+void ADXLSync(uint8_t verify)
+{
+	// Power mode (0x2D)-
+	//   Defaults to wake-up mode, which samples ~6 times a second no matter
+	//   what the ODR is; that's what the inactivity time is counted in.
+	//   Measurement mode (1:0 = 10) is always forced on.
+	config.powerCtl = (config.powerCtl & ~0x03) | (uint8_t)XL362_MEASURE_3D;
+#ifdef FEATURE_ADXL_VERIFY
+	if (verify && ((GPIOR0 & (1<<FLAG_ADXL_DIRTY)) == 0) &&
+		(ADXLReadByte((uint8_t)XL362_POWER_CTL) == config.powerCtl)) return;
+#else
+	if (verify && ((GPIOR0 & (1<<FLAG_ADXL_DIRTY)) == 0)) return;
+#endif
+	ADXLWriteByte((uint8_t)XL362_POWER_CTL, (uint8_t)XL362_STANDBY);
+	ADXLStart((uint8_t)XL362_REG_WRITE, (uint8_t)XL362_THRESH_ACTL);
+	// Activity threshold and time, inactivity threshold and time (0x20-0x26)-
+	//   Default to 150mg, one sample, 50mg, and 15 samples (~2.5 seconds).
+	//   The ADXL362 ignores the activity time in wake-up mode.
+	spiWriteBlock((uint8_t*)&config.athresh, 7);
+	// ACT_INACT_CTL (0x27)-
 	//   Needs to be set to LOOP mode (5:4 = 11)
 	//   We want referenced measurement mode for inactivity (3 = 1)
 	//   We need to activate inactivity detection (2 = 1)
 	//   We want referenced measurement mode for activity (1 = 1)
 	//   We need to activate activity detection (0 = 1)
-	ADXLWriteByte((uint8_t)XL362_ACT_INACT_CTL, (uint8_t)0xFF);
-	// INT1 function map register (0x2A)-
+	spiXfer(0xFF);
+	// FIFO_CONTROL (0x28)- FIFO off; it's only used while streaming data
+	//   out to the user, and the sample stream would just be wasted power
+	//   while asleep. FIFO_SAMPLES (0x29) goes back to its power-on default.
+	spiXfer((uint8_t)XL362_FIFO_MODE_OFF);
+	spiXfer(0x80);
+	// INTMAP1 (0x2A)-
 	//   Needs to be set to "Active Low" (7 = 1)
 	//   Needs to be set to activity mode (4 = 1)
 	//   Other bits must be zero.
-	ADXLWriteByte((uint8_t)XL362_INTMAP1, (uint8_t)0b10010000);
-	// Power control register (0x2D)-
-	//   Needs to be set to wake mode (3 = 1)
-	//   Need to turn on sampling mode (1:0 = 10)
-	//   Other bits must be zero
-	ADXLWriteByte((uint8_t)XL362_POWER_CTL, (uint8_t)0x0A);
+	spiXfer((uint8_t)(XL362_INT_LOW | XL362_INT_ACT));
+	// INTMAP2 (0x2B)- power-on default.
+	spiXfer(0x00);
+	// Range and output data rate (0x2C), then power mode (0x2D)-
+	//   Defaults to 2g at 100Hz. The thresholds are in LSBs, so at 4g or 8g
+	//   they're worth 2mg or 4mg apiece.
+	spiWriteBlock(&config.filterCtl, 2);
+	ADXLEnd(ADXL_CONFIG_LEN + 2);
+	GPIOR0 &= ~(1<<FLAG_ADXL_DIRTY);
+}
+
+// Read the latest X, Y, and Z, 12 bits each, in one burst. The data
+//   registers are little-endian and already sign-extended, same as the AVR
+//   wants them. Reading them clears DATA_READY.
+void ADXLReadXYZ(int16_t* xyz)
+{
+	ADXLReadBurst((uint8_t)XL362_XDATAL, (uint8_t*)xyz, 6);
 }
 
 // Simple functions to assert chip select and copy data in and out of the
-//   ADXL362. 
+//   ADXL362.
 uint8_t ADXLReadByte(uint8_t addr)
 {
-	PORTB &= !(1<<PB4);	
-	spiXfer((uint8_t)XL362_REG_READ);
-	spiXfer(addr);
-	addr = spiXfer(addr);
-	PORTB |= (1<<PB4);
+	ADXLStart((uint8_t)XL362_REG_READ, addr);
+	addr = spiXfer(0);
+	ADXLEnd(3);
 	return addr;
 }
 
 void ADXLWriteByte(uint8_t addr, uint8_t data)
 {
-	PORTB &= !(1<<PB4);
-	spiXfer((uint8_t)XL362_REG_WRITE);
-	spiXfer(addr);
+	ADXLStart((uint8_t)XL362_REG_WRITE, addr);
 	spiXfer(data);
+	ADXLEnd(3);
+}
+
+// Read len consecutive registers, starting at addr, in one transaction.
+void ADXLReadBurst(uint8_t addr, uint8_t* buffer, uint8_t len)
+{
+	ADXLStart((uint8_t)XL362_REG_READ, addr);
+	spiReadBlock(buffer, len);
+	ADXLEnd(len + 2);
+}
+
+#ifdef FEATURE_DUMP
+// Same, but rather than filling a buffer, hand each byte to sink() as it
+//   comes in. That lets us read the whole register map in one burst without
+//   finding RAM for it. The ADXL362 doesn't care how long CS sits low, so
+//   sink() may take its time. That's also why this one stays at 1MHz;
+//   sink() is usually waiting on the serial port.
+void ADXLReadStream(uint8_t addr, uint8_t len, void (*sink)(uint8_t))
+{
+	uint8_t i;
+	PORTB &= ~(1<<PB4);
+	spiXfer((uint8_t)XL362_REG_READ);
+	spiXfer(addr);
+	for (i = 0; i < len; i++) sink(spiXfer(0));
+	PORTB |= (1<<PB4);
+	energyAdd(spiBytes, len + 2);
+}
+#endif
+
+// Write len consecutive registers, starting at addr, in one transaction.
+void ADXLWriteBurst(uint8_t addr, uint8_t* buffer, uint8_t len)
+{
+	ADXLStart((uint8_t)XL362_REG_WRITE, addr);
+	spiWriteBlock(buffer, len);
+	ADXLEnd(len + 2);
+}
+
+#ifdef FEATURE_FIFO
+// FIFO_CONTROL, FIFO_SAMPLES and INTMAP1 are next to each other, so
+//   streaming goes on and off with one burst.
+static void ADXLFifoWrite(uint8_t fifoCtl, uint8_t samples, uint8_t intmap)
+{
+	uint8_t reg[3];
+	reg[0] = fifoCtl;
+	reg[1] = samples;
+	reg[2] = intmap;
+	ADXLWriteBurst((uint8_t)XL362_FIFO_CONTROL, reg, 3);
+}
+
+// Turn on the FIFO in stream mode; the oldest samples get discarded if we
+//   don't keep up. The watermark (in samples- there are three per XYZ set)
+//   is mapped onto the INT1 pin, so the main code can check the pin instead
+//   of polling FIFO_ENTRIES over SPI. Note that this replaces the activity
+//   interrupt on INT1, so ADXLFifoStop() must be called before sleeping.
+void ADXLFifoStart(uint16_t watermark)
+{
+	uint8_t fifoCtl = (uint8_t)XL362_FIFO_MODE_STREAM;
+	if (watermark > 255) fifoCtl |= (uint8_t)XL362_FIFO_SAMPLES_AH;
+	ADXLFifoWrite(fifoCtl, (uint8_t)watermark,
+		(uint8_t)(XL362_INT_LOW | XL362_INT_FIFO_WATERMARK));
+}
+
+// Stop streaming, and put the activity interrupt back on INT1. These are
+//   the same values ADXLSync() writes.
+void ADXLFifoStop(void)
+{
+	ADXLFifoWrite((uint8_t)XL362_FIFO_MODE_OFF, 0x80,
+		(uint8_t)(XL362_INT_LOW | XL362_INT_ACT));
+}
+
+// The FIFO entry count is a 10-bit value split across two registers. Read
+//   both in one burst, low byte first, so the count can't change between
+//   the two halves.
+uint16_t ADXLFifoEntries(void)
+{
+	uint16_t entries;
+	ADXLReadBurst((uint8_t)XL362_FIFO_ENTRIES_L, (uint8_t*)&entries, 2);
+	return entries & 0x03FF;
+}
+
+// Read count samples out of the FIFO. The FIFO read command doesn't take an
+//   address; the ADXL362 just keeps handing out samples, low byte first, for
+//   as long as chip select stays low. Don't ask for more than
+//   ADXLFifoEntries() says are there, or you'll get junk. The AVR is
+//   little-endian too, so the bytes can go straight into the buffer.
+void ADXLFifoRead(uint16_t* buffer, uint8_t count)
+{
+	clockFast();
+	PORTB &= ~(1<<PB4);
+	spiXfer((uint8_t)XL362_FIFO_READ);
+	spiReadBlock((uint8_t*)buffer, count*2);
 	PORTB |= (1<<PB4);
-}
\ No newline at end of file
+	clockSlow();
+	energyAdd(spiBytes, count*2 + 1);
+}
+#endif
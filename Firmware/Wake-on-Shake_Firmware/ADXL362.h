@@ -20,13 +20,43 @@ uint8_t ADXLReadByte(uint8_t);				// Does all the work to read a byte
 void    ADXLWriteByte(uint8_t, uint8_t);	// Does all the work to write a byte
 											//   to one of the ADXL362's
 											//   internal registers.
-void    ADXLConfig(void);					// Set up all the necessary values
-											//   to put the ADXL362 into the
-											//   mode we need for this product,
-											//   including user set variables.
+void    ADXLReadBurst(uint8_t, uint8_t*, uint8_t);	// Read a run of
+											//   consecutive registers in
+											//   one transaction.
+void    ADXLReadStream(uint8_t, uint8_t, void (*)(uint8_t));	// Read a
+											//   run of registers in one
+											//   transaction, passing each
+											//   byte to a function.
+void    ADXLReadXYZ(int16_t*);				// Read an XYZ sample in one
+											//   burst.
+void    ADXLWriteBurst(uint8_t, uint8_t*, uint8_t);	// Write a run of
+											//   consecutive registers in
+											//   one transaction.
+void    ADXLSync(uint8_t);					// Write the settings out to the
+											//   ADXL362, if they've changed.
 											
-/* NB- FIFO reading is not supported by the code at this time! It wasn't needed
-      for this code, and so was not implemented.
-*/
+void    ADXLFifoStart(uint16_t);			// Put the FIFO in stream mode with
+											//   the given watermark (in
+											//   samples) mapped onto INT1.
+void    ADXLFifoStop(void);					// Turn the FIFO back off.
+uint16_t ADXLFifoEntries(void);				// Number of samples in the FIFO.
+void    ADXLFifoRead(uint16_t*, uint8_t);	// Burst read samples out of the
+											//   FIFO in one CS cycle.
+
+// ADXLSync() writes THRESH_ACTL (0x20) through POWER_CTL (0x2D).
+#define ADXL_CONFIG_LEN		(XL362_POWER_CTL - XL362_THRESH_ACTL + 1)
+
+// ADXLConfig() sets all the necessary registers on the ADXL362 up to support
+//   the wake-on-shake type application. It's only needed at boot; after
+//   that, settings changes just call ADXLMarkDirty(), and the next
+//   ADXLSync() sends them. Use ADXLMarkDirty() too after poking a register
+//   behind ADXLSync()'s back.
+#define ADXLConfig()		ADXLSync(FALSE)
+#define ADXLMarkDirty()		(GPIOR0 |= (1<<FLAG_ADXL_DIRTY))
+
+// Registers 0x00 (DEVID_AD) through SELF_TEST are the whole register map.
+#define ADXL_REG_COUNT		(XL362_SELF_TEST + 1)
+
+#define ADXL_FIFO_MAX		511						// Largest legal watermark.
 
 #endif
\ No newline at end of file
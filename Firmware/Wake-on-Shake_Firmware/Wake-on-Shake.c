@@ -24,6 +24,8 @@ available, but most users will not need them.
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
+#include <string.h>
+#include <avr/pgmspace.h>
 #include "serial.h"
 #include "eeprom.h"
 #include "wake-on-shake.h"
@@ -32,15 +34,39 @@ available, but most users will not need them.
 #include "ADXL362.h"
 #include "xl362.h"
 #include "ui.h"
+#include "energy.h"
+#include "clock.h"
+#include "hal.h"
 
-uint16_t			t1Offset;			// This value, when written to TCNT1, 
-										//   is the offset to the delay before
-										//   sleep. It is 65535 - (delay)ms.
+config_t			config;				// RAM copy of the user settings. See
+										//   wake-on-shake.h.
+#ifdef FEATURE_FIFO
+uint16_t			fifoWatermark = 0;	// Nonzero while the ADXL362 FIFO is
+										//   being streamed out the serial port.
+#endif
+extern uint16_t		t1Start;			// See energy.c
+extern energyDelta_t	energy;				// See energy.c
 volatile uint8_t	sleepyTime = FALSE; // Flag used to communicate from the
 										//   ISR to the main program to send
 										//   the device into sleep mode.
-volatile uint8_t    serialRxData = 0;	// Data passing variable to get data
-										//   from the receive ISR back to main.
+#ifdef FEATURE_LONG_WAKE
+volatile uint16_t	wakeOverflows;		// Timer1 overflows left before
+										//   sleepyTime. See wakeStart().
+#endif
+#if defined(FEATURE_CONFIRM) || defined(FEATURE_STATS)
+static int16_t		restXYZ[3];			// Where the board sat when it went
+										//   to sleep. See motionSample().
+static uint16_t motionSample(void);
+#endif
+#ifdef FEATURE_STATS
+motion_t			motion;				// Motion seen since waking up.
+static void statsStart(void);
+#endif
+#ifdef FEATURE_LOG
+volatile uint8_t	wakeSource = LOG_BOOT;	// What woke us up; set by the
+										//   INT0/INT1 ISRs, for the log.
+static void logWake(void);
+#endif
 										
 // main(). If you don't know what this is, you need to do some serious
 //  work on your fundamentals.
@@ -95,10 +121,10 @@ int main(void)
 	//   The ADXL362 uses SPI Mode 0- CPHA = CPOL = 0.
 	
 	// UISCR- USWM1:0 are mode select pins; 01 is three-wire mode.
-	//   USICS1:0 are clock source select pins; 10 is software control.
-	//   USICLK puts the 4-bit data counter under software control.
-	//   Strobing USITC toggles the 4-bit clock signal.
-	USICR = (0<<USIWM1) | (1<<USIWM0) | (1<<USICS1) | (0<<USICS0) | (1<<USICLK);
+	//   USICS1:0 are clock source select pins; 00 means the data register
+	//   only shifts when USICLK is strobed, which spiXfer() does by hand.
+	//   Strobing USITC toggles the clock signal.
+	USICR = SPI_IDLE;
 	// USISR- Writing '1' to USIOIF will clear the 4-bit counter overflow
 	//   flag and ready it for the next transfer. Implicit here is a write
 	//   of zeroes to bits 3:0 of this register, which also clears the 4-bit
@@ -111,9 +137,10 @@ int main(void)
 
 	// For 9600 baud, at 1.000MHz (which is our clock speed, since we're
 	//   using the internal oscillator clocked down), UBRR should be set to
-	//   12, and the U2X bit of UCSRA should be set to '1'.
+	//   12, and the U2X bit of UCSRA should be set to '1'. clockSet() keeps
+	//   UBRR right when the clock changes; see clock.c.
 	UBRRH = 0;
-	UBRRL = 12;
+	UBRRL = CLOCK_UBRR(CLOCK_SLOW);
 	UCSRA = (1<<U2X);
 	// UCSRB- RXEN and TXEN enable the transmit and receive circuitry.
 	//   UCSZ2 is a frame size bit; when set to 0 (as here), the size is
@@ -128,18 +155,21 @@ int main(void)
 
 	// set_sleep_mode() is a nice little macro from the sleep library which
 	//   sets the stage nicely for sleep; after this, all you need to do is
-	//   call sleep_mode() to put the processor to sleep. Power Down mode is
-	//   the lowest possible sleep power state; all clocks are stopped and
-	//   only an external interrupt can wake the processor.
+	//   call sleep_mode() to put the processor to sleep. While we're awake,
+	//   the main loop naps in Idle mode between interrupts (FEATURE_NAP);
+	//   only the CPU stops, so Timer1, the USART, and the EEPROM keep going.
+	//   The main loop switches to Power Down mode, where all clocks are
+	//   stopped and only an external interrupt can wake the processor, for
+	//   real sleep. Without anything to nap for, it just stays there.
 	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleepModeAwake();
 	
-	// Check to make sure the EEPROM has been configured for first use by
-	//   looking at the "key" location. If not, configure it.
-	if (EEPROMReadByte((uint8_t)KEY_ADDR) != KEY) EEPROMConfig();
-	
-	// EEPROMRetrieve() pulls the various operational parameters out of
-	//   EEPROM and puts them in SRAM.
-	EEPROMRetrieve();
+	// configLoad() pulls the various operational parameters out of EEPROM
+	//   and puts them in SRAM. If they're missing or corrupt, it sets up
+	//   defaults instead.
+	configLoad();
+	energyLoad();
+	printConfig();
 	
 	// Configure the ADXL362 with the info we just pulled from EEPROM.
 	ADXLConfig();
@@ -150,15 +180,22 @@ int main(void)
 	//   over every 10 seconds when the device is awake, and when it ticks,
 	//   the device drops back into sleep.
 	// TCCR1B- 101 in CS1 bits divides the clock by 1024; ~one count per ms.
-	TCCR1B = (1<<CS12) | (0<<CS11) | (1<<CS10);
+	//   clockSlow() starts Timer1; with FEATURE_FAST_CLOCK, it also sets the
+	//   clock itself, rather than trusting the CKDIV8 fuse.
+	clockSlow();
 	// TCNT1- When this hits 65,536, an overflow interrupt occurs. By
 	//   "priming" it, we reduce the time until an interrupt occurs.
 	//   The if/else is to prevent the user accidentally
 	//   setting it so low that the part goes back to sleep before it can be
 	//   reprogrammed by the user through the command line.
-	TCNT1 = t1Offset;
-	// TIMSK- Set TOIE1 to enable Timer1 overflow interrupt
+	wakeStart();
+	// TIMSK- Set TOIE1 to enable Timer1 overflow interrupt, and OCIE1A for
+	//   the binary frame timeout (see frameWait()).
+#ifdef FEATURE_FRAMES
+	TIMSK = (1<<TOIE1) | (1<<OCIE1A);
+#else
 	TIMSK = (1<<TOIE1);
+#endif
 	
 	// loadOn() is a simple function that turns on the load. We'll turn it on
 	//   now and leave it on until sleep.
@@ -177,56 +214,484 @@ int main(void)
 	printMenu();
 	while(1)
 	{
+		// When the ADXL362 is in charge of how long we stay awake (see the
+		//   'k' command), there's nothing for us to do until it lets its INT1
+		//   pin go high at inactivity. In loop mode, the activity interrupt
+		//   holds until inactivity acknowledges it, so it's the same as the
+		//   AWAKE bit- except that AWAKE starts out set at power-up, and
+		//   would keep us on until the first bit of motion. So, once the
+		//   wake-up report is out, power down with only the pin change
+		//   interrupt on that pin, and INT0, turned on. Timer1 stops in
+		//   power-down, and its overflows don't end things here anyway. If
+		//   the user starts typing, the INT0 ISR puts us back on the timer,
+		//   for the UI. A motion wake-up that wakeConfirm() turned down waits
+		//   here the same way.
+#if defined(FEATURE_SENSOR_AWAKE) || defined(FEATURE_CONFIRM)
+		if (sleepyTime == SENSOR_AWAKE)
+		{
+			serialFlush();
+			EEPROMWait();
+			PCMSK2 = (1<<PCINT14);		// PD3
+			GIMSK = (1<<INT0) | (1<<PCIE2);
+			energyHoldStart();			// Timer1 won't count the load's
+										//   time from here on; see energy.c.
+			sleepModeAsleep();
+			cli();
+			while ((sleepyTime == SENSOR_AWAKE) && ((PIND & (1<<PD3)) == 0))
+			{
+				sleep_enable();
+				sei();
+				sleep_cpu();
+				sleep_disable();
+				cli();
+			}
+			if (sleepyTime == SENSOR_AWAKE) sleepyTime = TRUE;
+			GIMSK = 0;
+			sei();
+			energyHoldStop();
+			PCMSK2 = 0;
+			sleepModeAwake();
+		}
+#endif
 		// The main functionality is to go to sleep when there's been no activity
 		//   for some time; if Timer1 manages to overflow, it will set sleepyTime
 		//   true.
 		if (sleepyTime == TRUE)
 		{
 			serialWrite("z");			// Let the user know sleep mode is coming.
-			ADXLConfig();
+#ifdef FEATURE_FIFO
+			if (fifoWatermark != 0)		// Put the activity interrupt back on
+			{							//   INT1 if we were streaming.
+				fifoWatermark = 0;
+				ADXLFifoStop();
+				PCMSK2 = 0;				// GIMSK gets set below.
+			}
+#endif
+			ADXLSync(TRUE);				// Push any settings changes out to the
+										//   ADXL362, and make sure it's still
+										//   configured the way we think.
+#if defined(FEATURE_CONFIRM) || defined(FEATURE_STATS)
+			ADXLReadXYZ(restXYZ);		// See motionSample().
+#endif
+			loadOff();					// Turn off the load for sleepy time. This
+										//   has to come before the INT pins are
+										//   on, since their ISRs turn it back on.
+			wakeMarkOff();
 			GIMSK = (1<<INT0) |(1<<INT1);// Enable external interrupts to wake the
 										//   processor up; INT0 is incoming serial
 										//   data, INT1 is accelerometer interrupt
-			loadOff();					// Turn off the load for sleepy time.
-			sleep_mode();				// Go to sleep until awoken by an interrupt.
-			EEPROMRetrieve();			// Retrieve EEPROM values, mostly to print
-										//   them out to the user, if the wake-up
-										//   was due to serial data arriving.
+			energySleep();				// Count up the time we were awake.
+#ifdef FEATURE_LOG
+			logWake();					// Then note down what it was for.
+#endif
+			serialFlush();				// Let queued serial data finish going
+										//   out; the USART stops in power-down.
+			EEPROMWait();				// Same goes for queued EEPROM writes.
+#ifdef FEATURE_FRAMES
+			serialDiscard();			// Anything left over is the start of a
+										//   frame that will never finish.
+#endif
+			sleepModeAsleep();
+			do
+			{
+				// Go to sleep until awoken by an interrupt, or by the
+				//   watchdog, if it's counting sleep time; then, right back
+				//   to sleep. The INT pins are live from here on, and either
+				//   one may already have woken us up, so check sleepyTime
+				//   with interrupts off, the same way as for the idle nap.
+				cli();
+				if (sleepyTime == TRUE)
+				{
+					sleep_enable();
+					sei();
+					sleep_cpu();
+					sleep_disable();
+				}
+				sei();
+			} while (!energyWake());
+			sleepModeAwake();
+#ifdef FEATURE_STATS
+			statsStart();
+			motionSample();
+#endif
+#ifdef FEATURE_CONFIRM
+			// The load is already on; the INT0/INT1 ISR did that first thing-
+			//   unless it was the ADXL362, and there's a confirm window. If
+			//   the motion doesn't hold up, leave the load off, and wait for
+			//   the ADXL362 to see inactivity before going back to sleep;
+			//   its INT1 pin stays low until then.
+			if ((PORTD & (1<<PD4)) == 0)
+			{
+				if (wakeConfirm() == FALSE)
+				{
+#ifdef FEATURE_LOG
+					wakeSource = LOG_REJECTED;
+#endif
+					if (sleepyTime != TRUE) sleepyTime = SENSOR_AWAKE;
+					continue;
+				}
+				loadOn();
+			}
+#endif
+			// Now print the settings out to the user, in case the wake-up
+			//   was due to serial data arriving.
+			printConfig();
 			printMenu();
-			loadOn();					// Turn the load back on.
 		}
 		// Any data arriving over the serial port will trigger a serial receive
-		//   interrupt. If that data is non-null, serialParse() will be called to
-		//   deal with it.
-		if (serialRxData != 0) serialParse();
+		//   interrupt, which stuffs it into the receive buffer. If there's
+		//   anything in there, serialParse() will be called to deal with it.
+		if (serialAvailable()) serialParse();
+#ifdef FEATURE_FIFO
+		// While streaming, the ADXL362 pulls its INT1 line (PD3) low when
+		//   the FIFO watermark has been reached. No need to poll it over SPI,
+		//   and the nap below waits for it.
+		if ((fifoWatermark != 0) && ((PIND & (1<<PD3)) == 0)) fifoStream();
+#endif
+#ifdef FEATURE_STATS
+		// Motion statistics get a sample every time Timer0 says so; see
+		//   statsStart().
+		if (GPIOR0 & (1<<FLAG_STATS_DUE))
+		{
+			GPIOR0 &= ~(1<<FLAG_STATS_DUE);
+			motionSample();
+		}
+#endif
+		energyCheck();					// Save the energy counts if one of
+										//   them is getting full.
+#if defined(FEATURE_NAP) || defined(FEATURE_FIFO)
+		// Everything else we wait on comes with an interrupt- Timer1
+		//   overflow, received bytes, the transmit and EEPROM queues- so nap
+		//   until the next one. Check with interrupts off, or one could sneak
+		//   in between the check and the nap, and we'd sleep through it until
+		//   some later interrupt. sei() always runs the next instruction
+		//   before any interrupt, so nothing can get in before sleep_cpu(); a
+		//   pending interrupt just wakes us right back up. While streaming,
+		//   the INT1 pin change interrupt is on (see cmdFifo()), so nap until
+		//   the watermark, unless it's already there; without FEATURE_NAP,
+		//   that's the only time we nap. Received bytes that are only part of
+		//   a frame can wait for the rest of it; see frameWait().
+		cli();
+		if ((sleepyTime == FALSE)
+#if defined(FEATURE_FIFO) && defined(FEATURE_NAP)
+			&& ((fifoWatermark == 0) || (PIND & (1<<PD3)))
+#elif defined(FEATURE_FIFO)
+			&& (fifoWatermark != 0) && (PIND & (1<<PD3))
+#endif
+#ifdef FEATURE_STATS
+			&& ((GPIOR0 & (1<<FLAG_STATS_DUE)) == 0)
+#endif
+#ifdef FEATURE_FRAMES
+			&& (!serialAvailable() || (GPIOR0 & (1<<FLAG_FRAME_WAIT))))
+#else
+			&& !serialAvailable())
+#endif
+		{
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+#endif
+		halIdle();						// Nothing on the real part; lets time
+										//   pass in the host build.
+	}
+}
+
+#ifdef FEATURE_CONFIRM
+// The ADXL362 can't tell a door slam from someone picking the thing up; in
+//   wake-up mode it only needs one sample over the threshold. So when
+//   config.confirm is set, the INT1 ISR leaves the load off, and this takes
+//   a vote over that many more samples: the wake-up only stands if most of
+//   them are more than athresh away from where the board sat when it went
+//   to sleep. A shake swings back through the rest position now and then,
+//   so it can't be all of them. A bump is over after a sample or two.
+//   Anything from the user counts, too. DATA_READY goes on the INT1 pin for
+//   the duration, so we can nap between samples instead of polling over SPI.
+uint8_t wakeConfirm(void)
+{
+	uint8_t		need = (config.confirm >> 1) + 1;	// Samples still to move.
+	uint8_t		spare = config.confirm - need;		// Samples that may not.
+	ADXLWriteByte((uint8_t)XL362_INTMAP1,
+		(uint8_t)(XL362_INT_LOW | XL362_INT_DATA_READY));
+	motionSample();				// Clears DATA_READY, so we wait for a fresh one.
+	PCMSK2 = (1<<PCINT14);		// PD3
+	GIMSK = (1<<PCIE2);
+	while (need != 0)
+	{
+		// Timer1 still runs, so the wake time bounds all this.
+		cli();
+		while ((PIND & (1<<PD3)) && (sleepyTime != TRUE) && !serialAvailable())
+		{
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+			cli();
+		}
+		sei();
+		if (serialAvailable()) need = 0;
+		if ((need == 0) || (sleepyTime == TRUE)) break;
+		if (motionSample() > config.athresh) need--;
+		else if (spare-- == 0) break;
+	}
+	GIMSK = 0;
+	PCMSK2 = 0;
+	ADXLWriteByte((uint8_t)XL362_INTMAP1, (uint8_t)(XL362_INT_LOW | XL362_INT_ACT));
+	return (need == 0);
+}
+#endif
+
+#if defined(FEATURE_CONFIRM) || defined(FEATURE_STATS)
+
+// Take an XYZ sample, and return how far it is from where the board sat when
+//   it went to sleep, on whichever axis moved the most. Each axis' largest
+//   move and sum of squares go into the motion statistics. This runs at the
+//   statistics rate, so no dividing; the sums saturate rather than wrap.
+static uint16_t motionSample(void)
+{
+	int16_t		xyz[3];
+	uint16_t	delta;
+	uint16_t	largest = 0;
+#ifdef FEATURE_STATS
+	uint32_t	square;
+#endif
+	uint8_t		axis;
+	ADXLReadXYZ(xyz);
+	for (axis = 0; axis < 3; axis++)
+	{
+		delta = (xyz[axis] < restXYZ[axis]) ? restXYZ[axis] - xyz[axis] :
+			xyz[axis] - restXYZ[axis];
+		if (delta > largest) largest = delta;
+#ifdef FEATURE_STATS
+		if (delta > motion.peak[axis]) motion.peak[axis] = delta;
+		square = (uint32_t)delta * delta;
+		motion.sumSq[axis] += square;
+		if (motion.sumSq[axis] < square) motion.sumSq[axis] = 0xFFFFFFFF;
+#endif
+	}
+#ifdef FEATURE_STATS
+	if (motion.samples != 0xFFFF) motion.samples++;
+#endif
+	return largest;
+}
+#endif
+
+#ifdef FEATURE_STATS
+
+// Clear the motion statistics, and start Timer0 asking for samples at the
+//   rate in config.flags: CTC mode on clk/1024, so ~1ms ticks, with a period
+//   of 16 << (code - 1) ticks. That's ~61Hz at 1 down to ~4Hz at 5. Code 0
+//   turns it off; the wake-up sample and the confirm window still count.
+//   SPI bursts speed the clock up for a few us at a time; not enough to
+//   matter here.
+static void statsStart(void)
+{
+	uint8_t code = (config.flags & CONFIG_STATS) >> CONFIG_STATS_SHIFT;
+	memset(&motion, 0, sizeof(motion));
+	GPIOR0 &= ~(1<<FLAG_STATS_DUE);
+	TCCR0B = 0;
+	TCNT0 = 0;
+	if (code == 0)
+	{
+		TIMSK &= ~(1<<OCIE0A);
+		return;
+	}
+	if (code > 5) code = 5;
+	OCR0A = (8 << code) - 1;
+	TCCR0A = (1<<WGM01);
+	TCCR0B = (1<<CS02) | (1<<CS00);
+	TIMSK |= (1<<OCIE0A);
+}
+#endif
+
+#ifdef FEATURE_LOG
+
+// Integer square root, a bit at a time. Only used when a log record gets
+//   written, once per wake-up.
+static uint16_t isqrt(uint32_t n)
+{
+	uint32_t	root = 0;
+	uint32_t	bit = 1UL << 30;
+	while (bit > n) bit >>= 2;
+	while (bit != 0)
+	{
+		if (n >= root + bit)
+		{
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else root >>= 1;
+		bit >>= 2;
 	}
+	return (uint16_t)root;
 }
 
-// Utility function which pulls the various operational paramters out of EEPROM,
-//   puts them into SRAM, and prints them over the serial line.
-void EEPROMRetrieve(void)
+// Add a record for the wake-up that's ending to the log; see wakeLog_t. The
+//   timestamp is in ~1 minute units, from the energy counters; see
+//   energyMinutes(). Without the sleep clock, it only counts awake time. The
+//   peak is the largest of the three axes, and the RMS is of all three
+//   together. This is the one place the sums get divided by the number of
+//   samples.
+static void logWake(void)
 {
-	uint16_t threshold = EEPROMReadWord((uint8_t)ATHRESH);		// Activity threshold. See
-														//   ADXL362 datasheet for info.
-	t1Offset =  EEPROMReadWord((uint8_t)WAKE_OFFS);     // (65535 - t1Offset)ms elapse
-														//   between Timer1 interrupts.
-	serialWriteInt(threshold);							// Print threshold in human format.
-	serialWriteInt(65535 - t1Offset);					// Print the delay before sleep
-														//   in human format.
+	wakeLog_t	entry;
+	uint32_t	sum = 0;
+	uint8_t		axis;
+	entry.time   = energyMinutes();
+	entry.source = wakeSource;
+	entry.peak   = 0;
+	entry.rms    = 0;
+	for (axis = 0; axis < 3; axis++)
+	{
+		if (motion.peak[axis] > entry.peak) entry.peak = motion.peak[axis];
+		sum += motion.sumSq[axis];
+		if (sum < motion.sumSq[axis]) sum = 0xFFFFFFFF;
+	}
+	if (motion.samples != 0) entry.rms = isqrt(sum / motion.samples);
+	ringWrite((uint8_t)LOG_ADDR, LOG_SLOTS, LOG_REC_LEN, (uint8_t*)&entry);
 }
+#endif
 
-// Configuration function for EEPROM- "erased" for the EEPROM is 65535, so we need to
-//   change these to more manageable values the first time the board powers up, or the
-//   sleep interrupt will happen WAY too fast and the motion threshold will be WAY too
-//   high for practicality.
-void EEPROMConfig(void)
+// Prints the activity threshold and the delay before sleep over the serial
+//   line, in human format.
+void printConfig(void)
 {
-	t1Offset  = 60535;		// Corresponds to ~5s delay before going to sleep
-	// Now let's store these, along with the "key" that let's us know we've done this.
-	EEPROMWriteWord((uint8_t)ATHRESH, (uint16_t) 150);
-	EEPROMWriteWord((uint8_t)WAKE_OFFS, (uint16_t)t1Offset);
-	EEPROMWriteWord((uint8_t)ITHRESH, (uint16_t)50);
-	EEPROMWriteWord((uint8_t)ITIME, (uint16_t)15);
-	EEPROMWriteByte((uint8_t)KEY_ADDR, (uint8_t)KEY);
+	serialWriteInt(config.athresh);
+#ifdef FEATURE_LONG_WAKE
+	serialWriteLong(config.wakeTicks);
+#else
+	serialWriteInt(config.wakeTicks);
+#endif
 }
 
+// CRC of the first len bytes of the config block in RAM. For the whole
+//   block, that's everything but the CRC byte itself.
+static uint8_t configCrc(uint8_t len)
+{
+	uint8_t crc = CRC8_INIT;
+	uint8_t i;
+	for (i = 0; i < len; i++) crc = crc8Update(crc, ((uint8_t*)&config)[i]);
+	return crc;
+}
+
+// Load the config block out of EEPROM in one sequential read, and check its
+//   CRC. If the CRC is bad (first power-up, or a write that got cut off by a
+//   brown-out), see if there are settings from older firmware to carry over
+//   (FEATURE_MIGRATE); if not, use the defaults. Either way, store a good block for next time.
+//   The threshold and delay get changed a lot, so with FEATURE_JOURNAL, the
+//   newest values of those are kept in the journal rather than in the
+//   block; see configJournal().
+void configLoad(void)
+{
+	EEPROMReadBlock((uint8_t)CONFIG_ADDR, (uint8_t*)&config, CONFIG_LEN);
+	if (configCrc(CONFIG_LEN - 1) == config.crc)
+	{
+#ifdef FEATURE_JOURNAL
+		journalRead((uint8_t*)&config.wakeTicks);
+#endif
+		return;
+	}
+	// Otherwise, start from the defaults, and carry over whatever the
+	//   original firmware left behind, if anything.
+	configDefaults();
+#ifdef FEATURE_MIGRATE
+	if (EEPROMReadByte((uint8_t)KEY_ADDR) == KEY)
+	{
+		config.athresh  = EEPROMReadWord((uint8_t)ATHRESH);
+		config.wakeTicks = 65535 - EEPROMReadWord((uint8_t)WAKE_OFFS);
+		config.ithresh  = EEPROMReadWord((uint8_t)ITHRESH);
+		config.itime    = EEPROMReadWord((uint8_t)ITIME);
+		EEPROMWriteByte((uint8_t)KEY_ADDR, 0xFF);	// Only do this once; after
+													//   this the CRC is in charge.
+	}
+#endif
+#ifdef FEATURE_JOURNAL
+	journalRead((uint8_t*)&config.wakeTicks);
+#endif
+	configSave();
+}
+
+// Write the config block back to EEPROM with a fresh CRC. Only bytes that
+//   changed actually get written.
+void configSave(void)
+{
+	config.crc = configCrc(CONFIG_LEN - 1);
+	EEPROMUpdateBlock((uint8_t)CONFIG_ADDR, (uint8_t*)&config, CONFIG_LEN);
+#ifdef FEATURE_JOURNAL
+	configJournal();
+#endif
+}
+
+#ifdef FEATURE_PROFILES
+// Saved profiles let a unit be retuned for a new site with one command
+//   instead of a handful. A profile is a copy of the config block, CRC and
+//   all. Switching reads it straight over the settings in RAM; if its CRC
+//   is bad (nothing was ever saved there), the settings get put back the
+//   way they were, and we return FALSE. Otherwise it's stored as the config
+//   block, and the whole lot goes out to the ADXL362 together at the next
+//   sync. The caller has to call ADXLMarkDirty().
+uint8_t profileLoad(uint8_t slot)
+{
+	if (slot >= PROFILE_SLOTS) return FALSE;
+	EEPROMReadBlock(PROFILE_ADDR + slot*CONFIG_LEN, (uint8_t*)&config, CONFIG_LEN);
+	if (configCrc(CONFIG_LEN - 1) != config.crc)
+	{
+		configLoad();
+		return FALSE;
+	}
+	configSave();
+	return TRUE;
+}
+
+// Copy the settings into a profile slot.
+void profileSave(uint8_t slot)
+{
+	if (slot >= PROFILE_SLOTS) return;
+	config.crc = configCrc(CONFIG_LEN - 1);
+	EEPROMUpdateBlock(PROFILE_ADDR + slot*CONFIG_LEN, (uint8_t*)&config, CONFIG_LEN);
+}
+#endif
+
+#ifdef FEATURE_JOURNAL
+// The threshold and delay get retuned often, so instead of rewriting them in
+//   the config block every time, they get appended to the wear-leveled
+//   journal in eeprom.c. Nothing is written if they haven't changed.
+void configJournal(void)
+{
+	uint8_t journaled[JOURNAL_DATA_LEN];
+	if (journalRead(journaled) &&
+		(memcmp(journaled, &config.wakeTicks, JOURNAL_DATA_LEN) == 0)) return;
+	journalWrite((uint8_t*)&config.wakeTicks);
+}
+#endif
+
+// Default settings- "erased" for the EEPROM is 65535, so we need to change
+//   these to more manageable values the first time the board powers up, or the
+//   sleep interrupt will happen WAY too fast and the motion threshold will be
+//   WAY too high for practicality. They're copied out of flash in one go;
+//   that's less code than setting each field.
+static const config_t	defaults PROGMEM =
+{
+	5000,		// wakeTicks: ~5s delay before going to sleep
+	150,		// athresh: 150mg to wake up.
+	0,			// atime: one sample over athresh is activity.
+	50,			// ithresh: 50mg sleep detection level.
+	15,			// itime: 15 samples (~2.5 seconds) of inactivity.
+	0x13,		// filterCtl: 2g range, half bandwidth, 100Hz ODR.
+	XL362_SLEEP | XL362_MEASURE_3D,	// powerCtl: wake-up mode, normal
+				//   noise; ~6 samples a second.
+	0,			// flags: timed wake-ups.
+	0,			// confirm: the load goes on right away.
+	0			// crc: worked out by configSave().
+};
+
+void configDefaults(void)
+{
+	uint8_t i;
+	for (i = 0; i < CONFIG_LEN; i++)
+	{
+		((uint8_t*)&config)[i] = pgm_read_byte((uint8_t*)&defaults + i);
+	}
+}
@@ -0,0 +1,557 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+bench/bench.c
+Cycle counts and times for the firmware's hot paths, measured by running
+the real wake-on-shake.elf under simavr. Nothing in the firmware is instrumented;
+everything is timed from the outside, off of things the board itself would
+see on its pins. (On the board, build with FEATURE_WAKE_MARK and put a scope
+on PB0 to time wake-ups.) The steps:
+  - boot: reset until the first menu character goes into UDR,
+  - ADXLConfig(): the first burst of SPI traffic (CS low to CS high),
+  - wake: INT0/INT1 pulled low until the load turns on, and how long the
+    part stays awake afterwards,
+  - serial commands: the last byte of a command arriving until the first
+    byte of the reply goes into UDR, or for 'H' and 'L', which don't answer,
+    until the pin changes. The raw access commands need FEATURE_PEEK; try
+    make bench FEATURES=PEEK,
+  - sleep entry: the 'z' going into UDR until the SLEEP instruction.
+Each step is reported in cycles, and in time. The two aren't in step: with
+FEATURE_FAST_CLOCK, SPI bursts run with a smaller clock prescaler than the
+rest of the code (see clock.c), so the time is kept up to date by watching
+CLKPR. XON and XOFF don't count as replies.
+
+The ADXL362 on the other end of the USI is a plain register file; writes are
+remembered and read back. simavr doesn't simulate the USI, so this file does
+(three-wire mode, USICLK strobes only, which is all spi.c uses), and it
+doesn't stop the clocks in power-down, so Timer1's interrupt is held off
+while the part is asleep.
+
+Usage: wake-on-shake-bench [-m mcu] [-b baseline] [-w baseline] file.elf
+  -b file   Compare against a saved run; a step that takes more than 5% more
+            time than it used to is a regression, and the exit code is 1.
+  -w file   Save this run, for use with -b later.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+
+// ATtiny2313A data space addresses (I/O address + 0x20) for the registers
+//   simavr doesn't handle for us.
+#define USICR_ADDR		0x2D
+#define USIDR_ADDR		0x2F
+#define CLKPR_ADDR		0x46
+#define MCUCR_ADDR		0x55
+#define TIMSK_ADDR		0x59
+#define XON				0x11
+#define XOFF			0x13
+#define USICLK			1
+#define USITC			0
+#define CLKPCE			7
+#define SM0				4
+#define SM1				6
+#define TOIE1			7
+
+#define F_CPU			1000000UL		// What the fuses start the clock at.
+#define RC_HZ			8000000UL		// The RC oscillator, before CLKPR.
+#define BYTE_NS			(1000000000ULL * 10 / 9600)	// One 8-N-1 byte at 9600 baud.
+#define QUIET_CYCLES	20000			// No UART output for this long means
+										//   a reply is finished.
+#define BURST_GAP		2000			// SPI transactions closer together than
+										//   this are one burst.
+#define TIME_LIMIT_NS	(120 * 1000000000ULL)	// Two minutes.
+#define MAX_RESULTS		32
+
+typedef enum
+{
+	STEP_BOOT,			// Reset until the first sleep.
+	STEP_INT0,			// Wake up on INT0 (the RX line).
+	STEP_INT1,			// Wake up on INT1 (the ADXL362).
+	STEP_CMD,			// Send a serial command.
+	STEP_PIN,			// Send a pin command; it's done when PB1 changes.
+	STEP_SLEEP,			// Send 'z' and wait for sleep.
+	STEP_TIMEOUT		// Wait for Timer1 to put the part back to sleep.
+} stepKind_t;
+
+typedef struct
+{
+	stepKind_t		kind;
+	const char*		name;
+	const char*		text;		// For STEP_CMD and STEP_PIN.
+} step_t;
+
+// The script. Each step starts once the one before it is done.
+static const step_t steps[] =
+{
+	{ STEP_BOOT,    "boot",                 NULL },
+	{ STEP_INT0,    "wake INT0",            NULL },
+	{ STEP_CMD,     "cmd t (threshold)",    "t150\r" },
+	{ STEP_CMD,     "cmd d (delay)",        "d5000\r" },
+	{ STEP_CMD,     "cmd b (buffer)",       "b18\r" },
+	{ STEP_CMD,     "cmd w (ADXL write)",   "w39\r" },
+	{ STEP_CMD,     "cmd r (ADXL read)",    "r39\r" },
+	{ STEP_CMD,     "cmd e (EEPROM write)", "e100\r" },
+	{ STEP_CMD,     "cmd E (EEPROM read)",  "E100\r" },
+	{ STEP_CMD,     "cmd e (config write)", "e0\r" },
+	{ STEP_CMD,     "cmd p (pin read)",     "p1\r" },
+	{ STEP_PIN,     "cmd H (pin high)",     "H1" },
+	{ STEP_PIN,     "cmd L (pin low)",      "L1" },
+	{ STEP_SLEEP,   "sleep entry (z)",      NULL },
+	{ STEP_INT1,    "wake INT1",            NULL },
+	{ STEP_TIMEOUT, "awake until timeout",  NULL },
+};
+#define STEP_COUNT	(sizeof(steps) / sizeof(steps[0]))
+
+// A point in the run, in both cycles and time.
+typedef struct
+{
+	avr_cycle_count_t	cycle;
+	uint64_t			ns;
+} stamp_t;
+
+typedef struct
+{
+	char				name[40];
+	avr_cycle_count_t	cycles;
+	uint64_t			ns;
+} result_t;
+
+static avr_t*				avr;
+static avr_irq_t*			uartIn;
+static avr_irq_t*			int0Pin;
+static avr_irq_t*			int1Pin;
+
+static result_t				results[MAX_RESULTS];
+static int					resultCount = 0;
+
+// The clock: the time at the last CLKPR change, and the cycle length since.
+static stamp_t				clockChange = { 0, 0 };
+static uint64_t				cycleNs = 1000000000ULL / F_CPU;
+
+static unsigned				step = 0;
+static int					stepStarted = 0;
+static stamp_t				stepStamp;		// When the step's stimulus went in.
+static stamp_t				wakeStamp;
+static avr_cycle_count_t	lastTxCycle = 0;
+static stamp_t				firstTx;		// First UDR write of the step.
+static int					rejected = 0;	// The step's command got a ":-(".
+static stamp_t				zStamp;
+static stamp_t				bootStamp;
+static int					asleep = 0;
+static uint8_t				savedTimsk = 0;
+
+// SPI bursts, for ADXLConfig().
+static stamp_t				burstStart;
+static stamp_t				burstEnd;
+static int					burstsSeen = 0;
+
+// The ADXL362.
+static struct
+{
+	uint8_t		regs[0x40];
+	uint8_t		selected;
+	uint8_t		state;			// 0 command, 1 address, 2 data.
+	uint8_t		cmd;
+	uint8_t		addr;
+	uint8_t		bit;
+	uint8_t		inByte;
+	uint8_t		outByte;
+} adxl;
+
+static stamp_t now(void)
+{
+	stamp_t s;
+	s.cycle = avr->cycle;
+	s.ns = clockChange.ns + (avr->cycle - clockChange.cycle) * cycleNs;
+	return s;
+}
+
+static void record(const char* name, stamp_t from, stamp_t to)
+{
+	if (resultCount == MAX_RESULTS) return;
+	snprintf(results[resultCount].name, sizeof(results[0].name), "%s", name);
+	results[resultCount].cycles = to.cycle - from.cycle;
+	results[resultCount].ns = to.ns - from.ns;
+	resultCount++;
+}
+
+// clockSet() writes CLKPCE, then the new prescaler. simavr doesn't change
+//   speed, so keep track of the time here.
+static void clkprWrite(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+	if ((v & (1<<CLKPCE)) == 0)
+	{
+		clockChange = now();
+		cycleNs = (1000000000ULL / RC_HZ) << (v & 0x0F);
+	}
+	avr->data[addr] = v;
+}
+
+// ----------------------------------------------------------------------------
+// The ADXL362 and the USI.
+
+static void adxlReceive(uint8_t data)
+{
+	switch (adxl.state)
+	{
+		case 0:
+		adxl.cmd = data;
+		adxl.state = (data == 0x0D) ? 2 : 1;	// FIFO reads have no address.
+		break;
+		case 1:
+		adxl.addr = data;
+		adxl.state = 2;
+		break;
+		default:
+		if (adxl.cmd == 0x0A) adxl.regs[adxl.addr & 0x3F] = data;
+		adxl.addr++;
+		break;
+	}
+}
+
+static uint8_t adxlRespond(void)
+{
+	if ((adxl.state == 2) && (adxl.cmd == 0x0B)) return adxl.regs[adxl.addr & 0x3F];
+	return 0;
+}
+
+// Chip select is PB4.
+static void csChanged(avr_irq_t* irq, uint32_t value, void* param)
+{
+	adxl.selected = (value == 0);
+	if (adxl.selected)
+	{
+		adxl.state = 0;
+		adxl.bit = 0;
+		if (burstsSeen) return;
+		if (burstStart.cycle == 0) burstStart = now();
+		else if (avr->cycle - burstEnd.cycle > BURST_GAP)
+		{
+			record("ADXLConfig()", burstStart, burstEnd);
+			burstsSeen = 1;
+		}
+	}
+	else if (burstsSeen == 0) burstEnd = now();
+}
+
+// With no clock source selected, each write of USICLK to USICR shifts the
+//   data register one bit. USICLK and USITC always read back as zero.
+static void usicrWrite(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+	if ((v & (1<<USICLK)) && ((v & 0x0C) == 0))
+	{
+		if (adxl.bit == 0)
+		{
+			adxl.inByte = avr->data[USIDR_ADDR];
+			adxl.outByte = adxl.selected ? adxlRespond() : 0xFF;
+		}
+		avr->data[USIDR_ADDR] = (avr->data[USIDR_ADDR] << 1) |
+			((adxl.outByte >> (7 - adxl.bit)) & 1);
+		if (++adxl.bit == 8)
+		{
+			adxl.bit = 0;
+			if (adxl.selected) adxlReceive(adxl.inByte);
+		}
+	}
+	avr->data[addr] = v & ~((1<<USICLK) | (1<<USITC));
+}
+
+// ----------------------------------------------------------------------------
+// Pins and the UART.
+
+static void txByte(avr_irq_t* irq, uint32_t value, void* param)
+{
+	if ((value == XON) || (value == XOFF)) return;
+	if (firstTx.cycle == 0) firstTx = now();
+	lastTxCycle = avr->cycle;
+	if (value == '(') rejected = 1;
+	if ((value == ':') && (bootStamp.cycle == 0)) bootStamp = now();
+	if (value == 'z') zStamp = now();
+}
+
+// The load switch is PD4.
+static void loadChanged(avr_irq_t* irq, uint32_t value, void* param)
+{
+	if (!value || !asleep) return;
+	asleep = 0;
+	avr->data[TIMSK_ADDR] |= savedTimsk;
+	record(steps[step].name, stepStamp, now());
+	wakeStamp = stepStamp;
+	step++;
+	stepStarted = 0;
+}
+
+// 'H1' and 'L1' drive PB1; see pins[] in ui.c.
+static void pinChanged(avr_irq_t* irq, uint32_t value, void* param)
+{
+	if ((steps[step].kind != STEP_PIN) || !stepStarted) return;
+	record(steps[step].name, stepStamp, now());
+	step++;
+	stepStarted = 0;
+}
+
+static avr_cycle_count_t releasePin(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+	avr_raise_irq((avr_irq_t*)param, 1);
+	return 0;
+}
+
+static void sendString(const char* text)
+{
+	while (*text) avr_raise_irq(uartIn, (uint8_t)*text++);
+}
+
+// ----------------------------------------------------------------------------
+// The script.
+
+// The main loop naps in idle mode between interrupts, and simavr reports
+//   that as sleeping too. Only power-down counts as going to sleep.
+static int poweredDown(void)
+{
+	return (avr->data[MCUCR_ADDR] & ((1<<SM1) | (1<<SM0))) == (1<<SM0);
+}
+
+// The CPU just went into power-down. Only the external interrupts can wake
+//   it up from there, so keep Timer1 out of it.
+static void fellAsleep(void)
+{
+	asleep = 1;
+	savedTimsk = avr->data[TIMSK_ADDR] & (1<<TOIE1);
+	avr->data[TIMSK_ADDR] &= ~(1<<TOIE1);
+	switch (steps[step].kind)
+	{
+		case STEP_BOOT:
+		record("boot (reset to menu)", stepStamp, bootStamp);
+		break;
+		case STEP_SLEEP:
+		record(steps[step].name, zStamp, now());
+		break;
+		case STEP_TIMEOUT:
+		record(steps[step].name, wakeStamp, now());
+		break;
+		default:
+		fprintf(stderr, "bench: went to sleep during '%s'\n", steps[step].name);
+		exit(2);
+	}
+	step++;
+	stepStarted = 0;
+}
+
+// Called between instructions; starts the next step, or finishes a command.
+static void runScript(void)
+{
+	const step_t* s = &steps[step];
+	if (!stepStarted)
+	{
+		// Wake-ups start from sleep; everything else needs the part awake.
+		if (asleep != ((s->kind == STEP_INT0) || (s->kind == STEP_INT1))) return;
+		stepStarted = 1;
+		stepStamp = now();
+		firstTx.cycle = 0;
+		rejected = 0;
+		switch (s->kind)
+		{
+			case STEP_INT0:
+			avr_raise_irq(int0Pin, 0);
+			avr_cycle_timer_register(avr, 100, releasePin, int0Pin);
+			break;
+			case STEP_INT1:
+			avr_raise_irq(int1Pin, 0);
+			avr_cycle_timer_register(avr, 2000, releasePin, int1Pin);
+			break;
+			case STEP_CMD:
+			case STEP_PIN:
+			sendString(s->text);
+			// The last byte is done arriving this long from now. Commands
+			//   come in while the clock is slow.
+			stepStamp.ns += BYTE_NS * strlen(s->text);
+			stepStamp.cycle += BYTE_NS * strlen(s->text) / cycleNs;
+			break;
+			case STEP_SLEEP:
+			sendString("z");
+			break;
+			default:
+			break;
+		}
+		return;
+	}
+	if ((s->kind == STEP_CMD) && firstTx.cycle &&
+		(avr->cycle - lastTxCycle > QUIET_CYCLES))
+	{
+		// Commands left out of this build (FEATURE_PEEK) just get turned
+		//   down; there's nothing to time.
+		if (rejected) printf("%-24s not in this build\n", s->name);
+		else record(s->name, stepStamp, firstTx);
+		step++;
+		stepStarted = 0;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Baselines.
+
+static void saveBaseline(const char* file)
+{
+	int i;
+	FILE* f = fopen(file, "w");
+	if (f == NULL)
+	{
+		perror(file);
+		exit(2);
+	}
+	for (i = 0; i < resultCount; i++)
+	{
+		fprintf(f, "%llu %s\n", (unsigned long long)results[i].ns, results[i].name);
+	}
+	fclose(f);
+}
+
+// Returns the number of regressions.
+static int compareBaseline(const char* file)
+{
+	char line[80];
+	char name[40];
+	unsigned long long ns;
+	int i;
+	int regressions = 0;
+	FILE* f = fopen(file, "r");
+	if (f == NULL)
+	{
+		perror(file);
+		exit(2);
+	}
+	printf("\n%-24s %10s %10s %8s\n", "", "baseline us", "now us", "change");
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "%llu %39[^\n]", &ns, name) != 2) continue;
+		for (i = 0; i < resultCount; i++)
+		{
+			if (strcmp(name, results[i].name) != 0) continue;
+			printf("%-24s %10.1f %10.1f %+7.1f%%", name, ns / 1000.0,
+				results[i].ns / 1000.0,
+				ns ? 100.0 * ((double)results[i].ns - ns) / ns : 0.0);
+			if (results[i].ns * 100 > ns * 105)
+			{
+				printf("  REGRESSION");
+				regressions++;
+			}
+			printf("\n");
+		}
+	}
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char** argv)
+{
+	elf_firmware_t firmware;
+	const char* mcu = "attiny2313a";
+	const char* baseline = NULL;
+	const char* save = NULL;
+	uint32_t flags = 0;
+	int state;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "m:b:w:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'm': mcu = optarg; break;
+			case 'b': baseline = optarg; break;
+			case 'w': save = optarg; break;
+			default:
+			fprintf(stderr, "usage: %s [-m mcu] [-b baseline] [-w baseline] "
+				"file.elf\n", argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc - 1) return 2;
+
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(argv[optind], &firmware) != 0)
+	{
+		fprintf(stderr, "bench: can't read %s\n", argv[optind]);
+		return 2;
+	}
+	if (firmware.mmcu[0]) mcu = firmware.mmcu;
+	avr = avr_make_mcu_by_name(mcu);
+	if (avr == NULL)
+	{
+		fprintf(stderr, "bench: simavr doesn't know '%s'\n", mcu);
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+	avr->frequency = F_CPU;
+
+	// Keep the firmware's serial output off of our stdout.
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	uartIn = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+		UART_IRQ_OUTPUT), txByte, NULL);
+
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 4),
+		csChanged, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 4),
+		loadChanged, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 1),
+		pinChanged, NULL);
+	avr_register_io_write(avr, USICR_ADDR, usicrWrite, NULL);
+	avr_register_io_write(avr, CLKPR_ADDR, clkprWrite, NULL);
+
+	// INT0 and INT1 idle high, like the RX line and the ADXL362's
+	//   active-low INT1 do.
+	int0Pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+	int1Pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3);
+	avr_raise_irq(int0Pin, 1);
+	avr_raise_irq(int1Pin, 1);
+
+	memset(&adxl, 0, sizeof(adxl));
+	adxl.regs[0x00] = 0xAD;
+	adxl.regs[0x01] = 0x1D;
+	adxl.regs[0x02] = 0xF2;
+	stepStarted = 1;				// Boot starts itself.
+	memset(&stepStamp, 0, sizeof(stepStamp));
+
+	while (step < STEP_COUNT)
+	{
+		state = avr_run(avr);
+		if ((state == cpu_Done) || (state == cpu_Crashed))
+		{
+			fprintf(stderr, "bench: simulation stopped during '%s'\n", steps[step].name);
+			return 2;
+		}
+		if (now().ns > TIME_LIMIT_NS)
+		{
+			fprintf(stderr, "bench: timed out during '%s'\n", steps[step].name);
+			return 2;
+		}
+		if ((state == cpu_Sleeping) && !asleep && poweredDown()) fellAsleep();
+		if (step < STEP_COUNT) runScript();
+	}
+
+	printf("%-24s %10s %10s\n", "", "cycles", "ms");
+	for (i = 0; i < resultCount; i++)
+	{
+		printf("%-24s %10llu %10.3f\n", results[i].name,
+			(unsigned long long)results[i].cycles, results[i].ns / 1000000.0);
+	}
+	if (save != NULL) saveBaseline(save);
+	if ((baseline != NULL) && (compareBaseline(baseline) != 0)) return 1;
+	return 0;
+}
@@ -0,0 +1,36 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+clock.c
+Clock policy. The part idles along at 1MHz, and runs at 4MHz for bursts of
+SPI traffic, which the USI makes us clock out one instruction at a time.
+EEPROM programming and the USART go at their own pace whatever the clock
+is, so there's nothing to gain from speeding up for those.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+
+#ifdef FEATURE_FAST_CLOCK
+
+// Switch the system clock prescaler. The baud rate divider gets rewritten
+//   right behind it, so the USART loses at most a fraction of one sample
+//   period on a byte that happens to be going in or out; well within what
+//   the receiver on either end will put up with. Timer1 only runs at 1MHz;
+//   see CLOCK_TIMER1.
+void clockSet(uint8_t clkps)
+{
+	uint8_t sreg = SREG;
+	cli();
+	CLKPR = (1<<CLKPCE);		// Timed sequence; the new value has to be
+	CLKPR = clkps;				//   written within four cycles.
+	UBRRL = CLOCK_UBRR(clkps);
+	TCCR1B = (clkps == CLOCK_SLOW) ? CLOCK_TIMER1 : 0;
+	SREG = sreg;
+}
+#endif
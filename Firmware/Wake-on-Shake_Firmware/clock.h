@@ -0,0 +1,45 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+clock.h
+Definitions for switching the system clock between speeds.
+******************************************************************************/
+
+#ifndef _clock_h_included
+#define _clock_h_included
+
+// CLKPS values. The internal RC oscillator runs at 8MHz. 1MHz is the slowest
+//   clock 9600 baud can be cleanly divided out of, so that's where we sit;
+//   4MHz is for getting bursts of CPU-bound work over with. The part is only
+//   rated for 8MHz above 2.7V, and nothing keeps the board's supply (or a
+//   run-down battery) above that. There's no ADC on the tiny2313A to check
+//   VCC with first, so we stay inside the 4MHz it's good for down to 1.8V.
+#define CLOCK_SLOW		3			// 8MHz / 8 = 1MHz.
+#define CLOCK_FAST		1			// 8MHz / 2 = 4MHz.
+
+// UBRR for 9600 baud with U2X set: 8MHz / (8 * 9600) is 104, halved for
+//   each step of the prescaler. Right on for every CLKPS from 0 to 3.
+#define CLOCK_UBRR(clkps)	((104 >> (clkps)) - 1)
+
+// TCCR1B while running slow: clock / 1024, ~one count per ms. There's no
+//   clock / 4096, so Timer1 can't keep the same pace at 4MHz; it's stopped
+//   instead. Bursts are microseconds long, well under a tick.
+#define CLOCK_TIMER1	((1<<CS12) | (0<<CS11) | (1<<CS10))
+
+// Without FEATURE_FAST_CLOCK, we stay at whatever the CKDIV8 fuse says
+//   (1MHz), and clockSlow() just starts Timer1.
+#ifdef FEATURE_FAST_CLOCK
+void clockSet(uint8_t);		// Change the CLKPR prescaler, and everything
+							//   that depends on it.
+#define clockSlow()		clockSet(CLOCK_SLOW)
+#define clockFast()		clockSet(CLOCK_FAST)
+#else
+#define clockSlow()		(TCCR1B = CLOCK_TIMER1)
+#define clockFast()
+#endif
+
+#endif
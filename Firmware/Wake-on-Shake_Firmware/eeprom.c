@@ -17,19 +17,29 @@ probably not the case, but done is done.
 #include <avr/interrupt.h>
 #include "serial.h"
 #include "wake-on-shake.h"
+#include "energy.h"
 
-extern uint16_t				t1Offset;  // See Wake-on-Shake.cpp
+extern energyDelta_t	energy;		// See energy.c
 
-// Write a 16-bit value to EEPROM. Data is written big-endian. Note that
-//   blocking while waiting for prior writes to EEPROM to complete is
-//   handled in the byte read/write calls, which are called from here,
-//   so blocking is NOT needed in this function.
-void EEPROMWriteWord(uint8_t addr, uint16_t data)
-{
-	uint16_t dataTemp = data>>8;				// Isolate the high byte.
-	EEPROMWriteByte(addr, (uint8_t)dataTemp);   // Write high byte to EEPROM.
-	EEPROMWriteByte(addr+1, (uint8_t)data);		// Write low byte to EEPROM.
-}
+// The EEPROM regions are laid end to end, for whichever features are on
+//   (see CONFIG_ADDR in wake-on-shake.h). The lengths are spelled out as
+//   numbers so #if can add them up; the typedefs below fail to compile if
+//   one stops matching its struct.
+#if CONFIG_LEN > JOURNAL_ADDR
+#error "The config block runs into the journal"
+#endif
+#if LOG_END > KEY_ADDR
+#error "Not enough EEPROM for the JOURNAL, PROFILES, ENERGY and LOG features chosen"
+#endif
+#if defined(FEATURE_PROFILES) && (PROFILE_SLOTS < 1)
+#error "No EEPROM left for saved profiles with the JOURNAL, ENERGY and LOG chosen"
+#endif
+#if defined(FEATURE_LOG) && (LOG_SLOTS < LOG_MIN_SLOTS)
+#error "Not enough EEPROM left for the wake log with the JOURNAL and PROFILES chosen"
+#endif
+typedef char configLenCheck[(sizeof(config_t) == CONFIG_LEN) ? 1 : -1];
+typedef char energyLenCheck[(sizeof(energy_t) == ENERGY_LEN) ? 1 : -1];
+typedef char logLenCheck[(sizeof(wakeLog_t) + 2 == LOG_REC_LEN) ? 1 : -1];
 
 // Read a 16-bit value from EEPROM. Data is written big-endian. Note that
 //   blocking while waiting for prior writes to EEPROM to complete is
@@ -44,31 +54,313 @@ uint16_t EEPROMReadWord(uint8_t addr)
 	return readResult;
 }
 
-// 8-bit write to EEPROM. Since EEPROM writes can take rather a long time, we
-//   want to disable interrupts to avoid any unforeseen register mashing.
+// 8-bit write to EEPROM, in the usual erase-then-write (atomic) mode.
 void EEPROMWriteByte(uint8_t addr, uint8_t data)
 {
-	cli();							// Disable interrupts.
-	while (EECR & (1<<EEPE));		// Wait for in-progress EEPROM writes to
-									//  complete before using their resources.
-	EECR = (0<<EEPM1) | (0<<EEPM0); // See datasheet for details on the hows
-	EEAR = addr;					//  and whys of this write process.
+	EEPROMProgram(addr, data, EEPROM_ATOMIC);
+}
+
+#ifdef FEATURE_EEPROM_QUEUE
+// EEPROM writes take milliseconds apiece, so rather than sit and wait for
+//   them, EEPROMProgram() queues them up and the EE_READY ISR feeds them to
+//   the EEPROM one at a time. Each entry is an address and a data byte. The
+//   EEPROM is only 128 bytes, so bit 7 of the address is free to say that the
+//   write is a split one: erase-only if the data is 0xFF, write-only if not.
+#if EEPROM_SIZE > EEPROM_SPLIT
+#error "EEPROM_SPLIT has to be an address bit the EEPROM doesn't use"
+#endif
+volatile uint8_t	eeQueue[EEPROM_QUEUE_SIZE][2];
+volatile uint8_t	eeHead = 0;
+volatile uint8_t	eeTail = 0;
+
+// If interrupts are off (at boot, say), the EE_READY ISR can't run, so
+//   anything waiting on the queue has to push it along by hand.
+static void EEPROMPoll(void)
+{
+	if (((SREG & (1<<SREG_I)) == 0) && ((EECR & (1<<EEPE)) == 0))
+	{
+		EEPROMService();
+	}
+}
+
+// Queue a byte of EEPROM to be programmed using one of the three programming
+//   modes: atomic (erase then write, 3.4ms), erase only (byte becomes 0xFF,
+//   1.8ms), or write only (can only clear bits, 1.8ms). Returns right away
+//   unless the queue is full.
+void EEPROMProgram(uint8_t addr, uint8_t data, uint8_t mode)
+{
+	uint8_t nextHead = (eeHead + 1) & EEPROM_QUEUE_MASK;
+	addr &= ~EEPROM_SPLIT;		// EEAR ignores bit 7 anyway; a typed-in 'e200'
+								//   mustn't turn into a split write to 72.
+	if (mode != EEPROM_ATOMIC) addr |= EEPROM_SPLIT;
+	if (mode == EEPROM_ERASE_ONLY) data = 0xFF;
+	while (nextHead == eeTail) EEPROMPoll();	// Queue full; wait for room.
+	eeQueue[eeHead][0] = addr;
+	eeQueue[eeHead][1] = data;
+	eeHead = nextHead;
+	EECR |= (1<<EERIE);		// EE_READY fires right away if the EEPROM is idle.
+}
+
+// Start programming the next byte in the queue. Called from the EE_READY ISR
+//   whenever the EEPROM is ready; once the queue is empty, the interrupt gets
+//   turned off, since otherwise it would fire continuously.
+void EEPROMService(void)
+{
+	uint8_t addr;
+	uint8_t mode = EEPROM_ATOMIC;
+	if (eeHead == eeTail)
+	{
+		EECR &= ~(1<<EERIE);
+		return;
+	}
+	addr = eeQueue[eeTail][0];
+	EEDR = eeQueue[eeTail][1];
+	eeTail = (eeTail + 1) & EEPROM_QUEUE_MASK;
+	if (addr & EEPROM_SPLIT)
+	{
+		mode = (EEDR == 0xFF) ? EEPROM_ERASE_ONLY : EEPROM_WRITE_ONLY;
+	}
+	energyAdd(eeTenths, (mode == EEPROM_ATOMIC) ? ENERGY_EE_ATOMIC : ENERGY_EE_SPLIT);
+	EECR = mode | (1<<EERIE);		// See datasheet for details on the hows
+	EEAR = addr & ~EEPROM_SPLIT;	//  and whys of this write process.
+	EECR |= (1<<EEMPE);
+	EECR |= (1<<EEPE);
+}
+
+// TRUE if there's a write to addr still sitting in the queue.
+static uint8_t EEPROMPending(uint8_t addr)
+{
+	uint8_t i;
+	for (i = eeTail; i != eeHead; i = (i + 1) & EEPROM_QUEUE_MASK)
+	{
+		if ((eeQueue[i][0] & ~EEPROM_SPLIT) == addr) return TRUE;
+	}
+	return FALSE;
+}
+
+// Wait until every queued write has been finished. The sleep path has to do
+//   this before powering down.
+void EEPROMWait(void)
+{
+	while (EECR & ((1<<EERIE) | (1<<EEPE))) EEPROMPoll();
+}
+
+// 8-bit read from EEPROM. A read can't happen while the EEPROM is being
+//   programmed, so hold the write queue off, wait for the byte in progress (if
+//   any), and then do the read with interrupts off to keep registers intact.
+//   If the address has a write waiting in the queue, let that finish first so
+//   we don't read a stale value.
+uint8_t EEPROMReadByte(uint8_t addr)
+{
+	uint8_t sreg = SREG;		// Save the interrupt state; this gets called
+								//   before interrupts are turned on at boot.
+	uint8_t data;
+	while (EEPROMPending(addr)) EEPROMPoll();
+	cli();
+	EECR &= ~(1<<EERIE);		// Hold off the queue...
+	SREG = sreg;
+	while (EECR & (1<<EEPE));	// ...while the byte in progress finishes.
+	cli();
+	EEAR = addr;				// See the datasheet for more details about
+	EECR |= (1<<EERE);			//  this process.
+	data = EEDR;
+	if (eeHead != eeTail) EECR |= (1<<EERIE);	// Let the queue go again.
+	SREG = sreg;
+	return data;				// Return the value at the address in question.
+}
+#else
+// Without the queue, a write just waits for the one before it to finish,
+//   then starts programming in the given mode. EEMPE and EEPE have to be set
+//   within four cycles of each other, so no interrupts in between.
+void EEPROMProgram(uint8_t addr, uint8_t data, uint8_t mode)
+{
+	uint8_t sreg = SREG;
+	EEPROMWait();
+	energyAdd(eeTenths, (mode == EEPROM_ATOMIC) ? ENERGY_EE_ATOMIC : ENERGY_EE_SPLIT);
+	cli();
+	EECR = mode;				// See datasheet for details on the hows
+	EEAR = addr;				//  and whys of this write process.
 	EEDR = data;
 	EECR |= (1<<EEMPE);
 	EECR |= (1<<EEPE);
-	sei();							// Re-enable interrupts once the write is
-									//  underway- they can't hurt the process.
+	SREG = sreg;
 }
 
-// 8-bit read from EEPROM. The read needs to be atomic, so we want to disable
-//   interrupts before starting it up to keep registers intact.
+void EEPROMWait(void)
+{
+	while (EECR & (1<<EEPE));
+}
+
+// Nothing but the main code touches the EEPROM, so a read only has to wait
+//   for the last write to finish.
 uint8_t EEPROMReadByte(uint8_t addr)
 {
-	cli();						// Disable interrupts.
-	while (EECR & (1<<EEPE));	// Wait for any writes to finish, to avoid
-								//   a resource conflict.
+	EEPROMWait();
 	EEAR = addr;				// See the datasheet for more details about
-	EECR += (1<<EERE);			//  this process.
-	sei();						// Re-enable the interrupts.
-	return EEDR;				// Return the value at the address in question.
+	EECR |= (1<<EERE);			//  this process.
+	return EEDR;
+}
+#endif
+
+// Only write a byte if it's different from what's already there, and only
+//   do as much as is needed, too: if the new value just clears bits, a
+//   write-only cycle will do, and if it's 0xFF, an erase-only cycle will.
+//   Both take about half as long as a full erase-and-write, which is time
+//   the parser (without the queue) spends blocked, and charge spent.
+static void EEPROMUpdate(uint8_t addr, uint8_t old, uint8_t data)
+{
+	uint8_t mode = EEPROM_ATOMIC;
+	if (old == data) return;
+	if (data == 0xFF) mode = EEPROM_ERASE_ONLY;
+	else if ((old & data) == data) mode = EEPROM_WRITE_ONLY;
+	EEPROMProgram(addr, data, mode);
+}
+
+#ifdef FEATURE_EEPROM_QUEUE
+// Same, for a block of bytes. The old values are all read before anything
+//   is queued, since once the queue starts moving, every read has to wait
+//   for the byte in progress.
+void EEPROMUpdateBlock(uint8_t addr, uint8_t* data, uint8_t len)
+{
+	uint8_t old[EEPROM_QUEUE_SIZE];
+	uint8_t chunk;
+	uint8_t i;
+	while (len != 0)
+	{
+		chunk = (len > EEPROM_QUEUE_SIZE) ? EEPROM_QUEUE_SIZE : len;
+		EEPROMReadBlock(addr, old, chunk);
+		for (i = 0; i < chunk; i++) EEPROMUpdate(addr + i, old[i], data[i]);
+		addr += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+#else
+// Same, for a block of bytes. Each write waits for the one before it
+//   anyway, so there's nothing to gain from reading ahead.
+void EEPROMUpdateBlock(uint8_t addr, uint8_t* data, uint8_t len)
+{
+	while (len--)
+	{
+		EEPROMUpdate(addr, EEPROMReadByte(addr), *data++);
+		addr++;
+	}
+}
+#endif
+
+// Single byte version of EEPROMUpdateBlock().
+void EEPROMUpdateByte(uint8_t addr, uint8_t data)
+{
+	EEPROMUpdate(addr, EEPROMReadByte(addr), data);
+}
+
+// Read len bytes, starting at addr, into buffer. With the queue, unlike
+//   calling EEPROMReadByte() over and over, this only waits for pending
+//   writes and fiddles with the interrupt flag once for the whole block.
+//   Without it, EEPROMReadByte() is as cheap as it gets.
+void EEPROMReadBlock(uint8_t addr, uint8_t* buffer, uint8_t len)
+{
+#ifdef FEATURE_EEPROM_QUEUE
+	uint8_t sreg = SREG;		// Save the interrupt state; this gets called
+								//   before interrupts are turned on at boot.
+	EEPROMWait();				// Wait for any writes to finish.
+	cli();
+	while (len--)
+	{
+		EEAR = addr++;
+		EECR |= (1<<EERE);
+		*buffer++ = EEDR;
+	}
+	SREG = sreg;
+#else
+	while (len--) *buffer++ = EEPROMReadByte(addr++);
+#endif
+}
+
+// CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), one byte at a time. Bitwise
+//   rather than table-driven; a 256-byte table would eat an eighth of our
+//   flash.
+uint8_t crc8Update(uint8_t crc, uint8_t data)
+{
+	uint8_t i;
+	crc ^= data;
+	for (i = 0; i < 8; i++)
+	{
+		if (crc & 0x80) crc = (crc<<1) ^ 0x07;
+		else crc <<= 1;
+	}
+	return crc;
+}
+
+#if defined(FEATURE_JOURNAL) || defined(FEATURE_LOG)
+// The settings journal and the wake log are both rings of records, each a
+//   sequence number, some data, and a CRC-8 of both. Every write goes into
+//   the slot after the newest one, so the wear is spread across the whole
+//   ring instead of landing on the same few bytes every time. A ring is
+//   described by its first address, its number of slots, and its record
+//   length (data plus two); see journalRead() and friends in eeprom.h.
+
+// CRC of the record at addr, not counting its CRC byte.
+static uint8_t ringCrc(uint8_t addr, uint8_t len)
+{
+	uint8_t crc = CRC8_INIT;
+	uint8_t i;
+	for (i = 0; i < len - 1; i++) crc = crc8Update(crc, EEPROMReadByte(addr + i));
+	return crc;
+}
+
+// Find the newest good record- the one whose successor is bad, or has a
+//   sequence number that doesn't follow on. Returns slots if there aren't
+//   any good records at all.
+static uint8_t ringFind(uint8_t base, uint8_t slots, uint8_t len)
+{
+	uint8_t slot;
+	uint8_t next;
+	uint8_t addr;
+	uint8_t nextAddr;
+	for (slot = 0; slot < slots; slot++)
+	{
+		addr = base + slot*len;
+		if (ringCrc(addr, len) != EEPROMReadByte(addr + len - 1)) continue;
+		next = (slot + 1 == slots) ? 0 : slot + 1;
+		nextAddr = base + next*len;
+		if ((ringCrc(nextAddr, len) != EEPROMReadByte(nextAddr + len - 1)) ||
+			(EEPROMReadByte(nextAddr) != (uint8_t)(EEPROMReadByte(addr) + 1))) return slot;
+	}
+	return slots;
+}
+
+// Copy the data out of the newest record into data. Returns FALSE (and leaves
+//   data alone) if the ring is empty.
+uint8_t ringRead(uint8_t base, uint8_t slots, uint8_t len, uint8_t* data)
+{
+	uint8_t slot = ringFind(base, slots, len);
+	if (slot == slots) return FALSE;
+	EEPROMReadBlock(base + slot*len + 1, data, len - 2);
+	return TRUE;
+}
+
+// Add a record to the ring, in the slot after the newest one. The old
+//   record in that slot is the oldest in the ring, so it's safe to lose. The
+//   CRC is the last byte in the record, and the queue writes in order, so a
+//   torn write leaves a bad record rather than a wrong one.
+void ringWrite(uint8_t base, uint8_t slots, uint8_t len, uint8_t* data)
+{
+	uint8_t slot = ringFind(base, slots, len);
+	uint8_t seq = 0;
+	uint8_t crc;
+	uint8_t i;
+	if (slot != slots)
+	{
+		seq = EEPROMReadByte(base + slot*len) + 1;
+		slot = (slot + 1 == slots) ? 0 : slot + 1;
+	}
+	else slot = 0;
+	base += slot*len;
+	crc = crc8Update(CRC8_INIT, seq);
+	for (i = 0; i < len - 2; i++) crc = crc8Update(crc, data[i]);
+	EEPROMUpdateByte(base, seq);
+	EEPROMUpdateBlock(base + 1, data, len - 2);
+	EEPROMUpdateByte(base + len - 1, crc);
 }
+#endif
@@ -14,8 +14,56 @@ Function definitions for the eeprom.
 #define _eeprom_h_included
 
 uint16_t EEPROMReadWord(uint8_t);				// 16-bit read from EEPROM.
-void     EEPROMWriteWord(uint8_t, uint16_t);	// 16-bit write to EEPROM.
 uint8_t  EEPROMReadByte(uint8_t);				// 8-bit read from EEPROM.
 void     EEPROMWriteByte(uint8_t, uint8_t);		// 8-bit write to EEPROM.
+void     EEPROMProgram(uint8_t, uint8_t, uint8_t);	// 8-bit write to EEPROM
+												//  using a given EEPM mode.
+void     EEPROMService(void);					// Start the next queued write.
+												//  Called from the EE_READY ISR.
+void     EEPROMWait(void);						// Block until all queued writes
+												//  are done. Call before sleeping!
+void     EEPROMUpdateByte(uint8_t, uint8_t);	// 8-bit write, skipped if the
+												//  byte already holds the value.
+void     EEPROMUpdateBlock(uint8_t, uint8_t*, uint8_t);	// Same, for a block
+												//  of bytes.
+void     EEPROMReadBlock(uint8_t, uint8_t*, uint8_t);	// Sequential read of
+												//  a block of bytes.
+uint8_t  crc8Update(uint8_t, uint8_t);			// Add a byte to a CRC-8.
+uint8_t  ringRead(uint8_t, uint8_t, uint8_t, uint8_t*);	// Get the newest
+												//  record in a ring.
+void     ringWrite(uint8_t, uint8_t, uint8_t, uint8_t*);	// Add a record
+												//  to a ring.
+
+#define CRC8_INIT	0xFF	// Starting value for crc8Update().
+
+#define EEPROM_SIZE	128		// Bytes of EEPROM on the ATtiny2313A.
+
+// EEPM1:0 values for EEPROMProgram().
+#define EEPROM_ATOMIC		((0<<EEPM1) | (0<<EEPM0))	// Erase, then write.
+#define EEPROM_ERASE_ONLY	((0<<EEPM1) | (1<<EEPM0))	// Byte becomes 0xFF.
+#define EEPROM_WRITE_ONLY	((1<<EEPM1) | (0<<EEPM0))	// Can only clear bits.
+
+// With FEATURE_EEPROM_QUEUE, writes are queued and carried out by the
+//   EE_READY ISR. See EEPROMProgram().
+#define EEPROM_QUEUE_SIZE	4		// MUST be a power of two. Each entry is
+									//   two bytes of RAM.
+#define EEPROM_QUEUE_MASK	(EEPROM_QUEUE_SIZE - 1)
+#define EEPROM_SPLIT		0x80	// Queued address flag; see EEPROMProgram().
+
+// With FEATURE_JOURNAL, the settings journal lives in otherwise unused
+//   EEPROM, after the config block. See journalWrite(). Each slot takes one
+//   eighth of the writes, and it's laid out the way it always was, so the
+//   newest record survives an upgrade.
+#define JOURNAL_ADDR		16		// EEPROM address of the first record.
+#define JOURNAL_SLOTS		8		// Number of records in the ring.
+#define JOURNAL_DATA_LEN	(2 + TICKS_LEN)			// Data bytes per record.
+#define JOURNAL_REC_LEN		(JOURNAL_DATA_LEN + 2)	// Plus sequence and CRC.
+#ifdef FEATURE_JOURNAL
+#define JOURNAL_END			(JOURNAL_ADDR + JOURNAL_SLOTS*JOURNAL_REC_LEN)
+#else
+#define JOURNAL_END			JOURNAL_ADDR
+#endif
+#define journalRead(data)	ringRead(JOURNAL_ADDR, JOURNAL_SLOTS, JOURNAL_REC_LEN, (data))
+#define journalWrite(data)	ringWrite(JOURNAL_ADDR, JOURNAL_SLOTS, JOURNAL_REC_LEN, (data))
 
 #endif
@@ -0,0 +1,213 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+energy.c
+Residency counters and charge estimates. Awake time comes from Timer1, which
+is already running whenever we're awake. Busy time is worked out from counts
+of SPI bytes, EEPROM writes, and serial bytes, since each of those takes a
+known amount of time, and timing them with 1ms Timer1 ticks would just give
+zeroes. Timer1 is stopped during SPI bursts (see clock.c), so SPI time isn't
+part of the awake time. Power-down time comes from the watchdog, if the sleep
+clock is on; everything else is stopped in power-down. So does the time the
+ADXL362 holds the load on while we power down (see SENSOR_AWAKE), which
+counts as awake time.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <string.h>
+#include "energy.h"
+#include "eeprom.h"
+#include "serial.h"
+#include "wake-on-shake.h"
+
+extern volatile uint8_t		sleepyTime;		// See Wake-on-Shake.cpp
+
+#ifdef TIMER1_TRACKED
+uint16_t			t1Start;			// Last value loaded into TCNT1.
+#endif
+
+#ifdef FEATURE_ENERGY
+energyDelta_t		energy;				// Counted since the last save. See
+										//   energy.h.
+
+#define energyTotal(counter)	energyRead(offsetof(energy_t, counter))
+
+// One of the totals in EEPROM; offset is where it is in an energy_t.
+static uint32_t energyRead(uint8_t offset)
+{
+	uint32_t	total;
+	EEPROMReadBlock((uint8_t)ENERGY_ADDR + offset, (uint8_t*)&total, 4);
+	return total;
+}
+
+// Adds delta into one of the totals. Only the bytes that change get
+//   written, which is mostly the low ones.
+static void energyFold(uint8_t offset, uint32_t delta)
+{
+	uint32_t	total = energyRead(offset) + delta;
+	EEPROMUpdateBlock((uint8_t)ENERGY_ADDR + offset, (uint8_t*)&total, 4);
+}
+
+// The totals start out erased (all ones) on a new board. The RAM counts
+//   start at zero anyway.
+void energyLoad(void)
+{
+	if (energyTotal(wakes) == 0xFFFFFFFF) energyClear();
+}
+
+// Takes the counts so far out of RAM with interrupts off, so nothing the
+//   ISRs count goes missing, then adds them in.
+void energySave(void)
+{
+	energyDelta_t	delta;
+	cli();
+	delta = energy;
+	memset(&energy, 0, sizeof(energy));
+	sei();
+	energyFold(offsetof(energy_t, wakes), delta.wakes);
+	energyFold(offsetof(energy_t, sleeps), delta.sleeps);
+	energyFold(offsetof(energy_t, awakeTicks), delta.awakeTicks);
+	energyFold(offsetof(energy_t, spiBytes), delta.spiBytes);
+	energyFold(offsetof(energy_t, eeTenths), delta.eeTenths);
+	energyFold(offsetof(energy_t, uartBytes), delta.uartBytes);
+}
+
+void energyClear(void)
+{
+	uint8_t		i;
+	cli();
+	memset(&energy, 0, sizeof(energy));
+	t1Start = TCNT1;
+	sei();
+	for (i = 0; i < ENERGY_LEN; i++) EEPROMUpdateByte((uint8_t)ENERGY_ADDR + i, 0);
+}
+
+// The watchdog only ever runs as an interrupt (no reset). Changing it takes
+//   a timed sequence; see the datasheet.
+static void wdtStart(uint8_t prescale)
+{
+	cli();
+	WDTCSR = (1<<WDCE) | (1<<WDE);
+	WDTCSR = (1<<WDIE) | prescale;
+	sei();
+}
+
+static void wdtStop(void)
+{
+	cli();
+	WDTCSR = (1<<WDCE) | (1<<WDE);
+	WDTCSR = 0;
+	sei();
+}
+
+// Called right before going to sleep. Adds the last stretch of awake time
+//   to the total, saves the counters every so often, and starts the
+//   watchdog, with its longest period, if it's going to be counting sleep
+//   time.
+void energySleep(void)
+{
+	cli();
+	energy.awakeTicks += (uint16_t)(TCNT1 - t1Start);
+	t1Start = TCNT1;
+	sei();
+	if (++energy.wakes >= ENERGY_SAVE_WAKES) energySave();
+	GPIOR0 &= ~(1<<FLAG_SLEEP_CLOCK);
+	if (EEPROMReadByte((uint8_t)SLEEP_CLOCK_ADDR) == 1)
+	{
+		GPIOR0 |= (1<<FLAG_SLEEP_CLOCK);
+		wdtStart((1<<WDP3) | (1<<WDP0));
+	}
+}
+
+// Called every time sleep_mode() returns. If the watchdog woke us up, count
+//   the period and tell the caller to go back to sleep; the INT0 and INT1
+//   ISRs clear sleepyTime, so a real wake-up looks different. The time since
+//   the last watchdog period is lost, which is never more than 8s per wake.
+uint8_t energyWake(void)
+{
+	if (sleepyTime == TRUE)
+	{
+		energy.sleeps++;
+		energyCheck();
+		return FALSE;
+	}
+	if (GPIOR0 & (1<<FLAG_SLEEP_CLOCK)) wdtStop();
+	return TRUE;
+}
+
+#ifdef FEATURE_SENSOR_AWAKE
+// While the ADXL362 keeps us awake, we wait for it in power-down, where
+//   Timer1 stops, but the load is still on. The watchdog keeps time instead:
+//   its 1.024s period is 1000 Timer1 ticks, and the WDT ISR adds that much
+//   awake time each period, as long as PD4 is high. As with sleep, the time
+//   since the last period is lost, but that's never more than a second. The
+//   watchdog runs whether or not the sleep clock is on; next to the load,
+//   it costs nothing.
+void energyHoldStart(void)
+{
+	if (PORTD & (1<<PD4)) wdtStart((1<<WDP2) | (1<<WDP1));
+}
+
+void energyHoldStop(void)
+{
+	wdtStop();
+}
+#endif
+
+// Prints ms, and returns ms times the current for state which, as charge in
+//   uAh. Dividing the time down first keeps the product in 32 bits; the error
+//   is less than 3.6s worth per state.
+static uint32_t energyCharge(uint32_t ms, uint8_t which)
+{
+	serialWriteLong(ms);
+	return (ms / 3600) * EEPROMReadWord(CURRENT_ADDR + which*2) / 1000;
+}
+
+// Prints, one per line: wakes, seconds in power-down, then ms spent awake
+//   and idle, on SPI, programming EEPROM, and sending serial data, and last,
+//   the estimated charge used, in uAh. Set the current table first! The
+//   totals get brought up to date first, so they're all in EEPROM.
+void energyReport(void)
+{
+	uint32_t	awake;
+	uint32_t	spi, ee, uart, sleep, charge;
+
+	energySave();
+	spi = energyTotal(spiBytes) / (1000 / ENERGY_SPI_US);
+	ee = energyTotal(eeTenths) / 10;
+	uart = energyTotal(uartBytes);
+	uart += uart / 24;									// 1.04ms each
+	sleep = energyTotal(sleeps);
+	sleep = sleep * 8 + (sleep * 24) / 125;				// 8.192s
+	awake = energyTotal(awakeTicks);
+	cli();
+	awake += energy.awakeTicks + (uint16_t)(TCNT1 - t1Start);	// Include now.
+	sei();
+	awake += (awake * 3) / 125;			// Timer1 ticks are 1.024ms.
+	awake -= ee + uart;					// What's left is idle.
+	if ((int32_t)awake < 0) awake = 0;
+
+	serialWriteLong(energyTotal(wakes));
+	serialWriteLong(sleep);
+	charge = (sleep / 36) * EEPROMReadWord(CURRENT_ADDR) / 100000;	// nA
+	charge += energyCharge(awake, CURRENT_IDLE);
+	charge += energyCharge(spi, CURRENT_SPI);
+	charge += energyCharge(ee, CURRENT_EEPROM);
+	charge += energyCharge(uart, CURRENT_UART);
+	serialWriteLong(charge);
+}
+
+// 65536 Timer1 ticks is 67s, and 8 watchdog periods is 66s, so it's all
+//   shifts.
+uint16_t energyMinutes(void)
+{
+	return (uint16_t)((energyTotal(awakeTicks) + energy.awakeTicks) >> 16) +
+		   (uint16_t)((energyTotal(sleeps) + energy.sleeps) >> 3);
+}
+#endif
@@ -0,0 +1,149 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+energy.h
+Definitions for keeping track of where the time (and so, the battery) goes.
+******************************************************************************/
+
+#ifndef _energy_h_included
+#define _energy_h_included
+
+// Running totals since the counters were last cleared. These live in
+//   EEPROM; see ENERGY_ADDR.
+typedef struct
+{
+	uint32_t	wakes;		// Times the part has gone back to sleep.
+	uint32_t	sleeps;		// Watchdog periods (8.192s) spent in power-down.
+	uint32_t	awakeTicks;	// Timer1 ticks (1.024ms) spent awake, or with
+							//   the load on; see energyHoldStart().
+	uint32_t	spiBytes;	// Bytes moved to and from the ADXL362.
+	uint32_t	eeTenths;	// EEPROM programming time, in 0.1ms.
+	uint32_t	uartBytes;	// Bytes sent out the serial port.
+} energy_t;
+
+// What's been counted since the totals were last brought up to date, which
+//   is all that's kept in RAM. energySave() adds it in every
+//   ENERGY_SAVE_WAKES wakes, or sooner, if one of the 16-bit counts gets to
+//   ENERGY_FOLD; anything counted since is lost if the power goes away.
+//   Timer1 adds up to 65535 ticks at a time, from its ISR, so awakeTicks
+//   needs all 32 bits.
+typedef struct
+{
+	uint32_t	awakeTicks;
+	uint16_t	sleeps;
+	uint16_t	spiBytes;
+	uint16_t	eeTenths;
+	uint16_t	uartBytes;
+	uint8_t		wakes;
+} energyDelta_t;
+
+#ifdef FEATURE_ENERGY
+void energyLoad(void);		// Pull the counters out of EEPROM at boot.
+void energySave(void);		// Add the counts so far into the EEPROM totals.
+void energyClear(void);		// Zero the counters (and the EEPROM copy).
+void energySleep(void);		// Close out the awake time; call before sleeping.
+uint8_t energyWake(void);	// Call after every wake from sleep. Returns
+							//   FALSE if it was just the watchdog, and the
+							//   part should go right back to sleep.
+void energyReport(void);	// Print the counters and the charge used.
+uint16_t energyMinutes(void);	// Time since the counters were cleared, in
+								//   ~1 minute units. See logWake().
+#ifdef FEATURE_SENSOR_AWAKE
+void energyHoldStart(void);	// Count power-down time with the load on as
+void energyHoldStop(void);	//   awake time, while the ADXL362 holds it.
+#else
+#define energyHoldStart()
+#define energyHoldStop()
+#endif
+#define energyAdd(counter, n)	(energy.counter += (n))	// Count something.
+// Called from the main loop, to fold the counts in before a 16-bit one can
+//   wrap. Some of them are counted in ISRs, so a read here can be torn; at
+//   worst, that's an early save, or one that waits for the next time around.
+#define energyCheck()	do { if ((energy.sleeps | energy.spiBytes | \
+									energy.eeTenths | energy.uartBytes) & \
+									ENERGY_FOLD) energySave(); } while (0)
+#else
+// Without the counters, there's nothing to count, and only a real wake-up
+//   ends sleep.
+#define energyLoad()
+#define energySleep()
+#define energyHoldStart()
+#define energyHoldStop()
+#define energyWake()			(sleepyTime != TRUE)
+#define energyAdd(counter, n)
+#define energyCheck()
+#endif
+
+// Timer1 counts up to the overflow that puts us to sleep, and gets reloaded
+//   whenever something happens to keep us awake. t1Start is the count it
+//   was last loaded with, so the time between loads can be added up. Use
+//   timer1Start() on wake-up, when there's no awake time to count yet, and
+//   timer1Load() after that. Both need interrupts off (ISR, or cli()).
+//   Only the energy counters and the binary frame timeout need t1Start;
+//   without them, these just load TCNT1.
+#if defined(FEATURE_ENERGY) || defined(FEATURE_FRAMES)
+#define TIMER1_TRACKED
+#define timer1Start(value)	(TCNT1 = t1Start = (value))
+#define timer1Load(value)	do { energyAdd(awakeTicks, (uint16_t)(TCNT1 - t1Start)); \
+								 timer1Start(value); } while (0)
+#define timer1Overflow()	do { energyAdd(awakeTicks, (uint16_t)(0 - t1Start)); \
+								 t1Start = 0; } while (0)
+#else
+#define timer1Start(value)	(TCNT1 = (value))
+#define timer1Load(value)	timer1Start(value)
+#define timer1Overflow()
+#endif
+
+// With FEATURE_LONG_WAKE, the awake time, config.wakeTicks, is 32 bits;
+//   Timer1 only counts 16. The low 16 bits go into TCNT1, and wakeOverflows
+//   counts off whole trips around the timer after that; the overflow with
+//   none left puts us to sleep. Timer1's clock / 1024 is already the
+//   coarsest prescaler there is, and fine enough for ms settings, so the
+//   overflow interrupt only fires every 67s. wakeStart() and wakeLoad() go
+//   with timer1Start() and timer1Load().
+#ifdef FEATURE_LONG_WAKE
+#define wakeOverflowsFor(ticks)	((uint16_t)(((ticks) - 1) >> 16))
+#define wakeStart()	do { timer1Start((uint16_t)-config.wakeTicks); \
+						 wakeOverflows = wakeOverflowsFor(config.wakeTicks); } while (0)
+#define wakeLoad()	do { timer1Load((uint16_t)-config.wakeTicks); \
+						 wakeOverflows = wakeOverflowsFor(config.wakeTicks); } while (0)
+#else
+#define wakeStart()	timer1Start((uint16_t)-config.wakeTicks)
+#define wakeLoad()	timer1Load((uint16_t)-config.wakeTicks)
+#endif
+
+#define ENERGY_SAVE_WAKES	16		// Wakes between saves to EEPROM.
+#define ENERGY_FOLD			0x8000	// Save once a 16-bit count gets this big.
+#define ENERGY_HOLD_TICKS	1000	// Timer1 ticks in a 1.024s watchdog period.
+#define ENERGY_SPI_US		6		// Time to move one SPI byte at 4MHz, in us.
+#define ENERGY_EE_ATOMIC	34		// EEPROM erase-and-write time, in 0.1ms.
+#define ENERGY_EE_SPLIT		18		// Erase-only or write-only time, in 0.1ms.
+
+// EEPROM layout. The counters go right after the saved profiles. After them comes
+//   the current table: five 16-bit values, big-endian like EEPROMReadWord()
+//   wants, set with the 'b' and 'e' commands. Power-down current is in nA; the rest are in uA, and are
+//   the total draw of the board (load included) while in that state. Then
+//   one byte which turns the watchdog sleep clock on if it's 1. The sleep
+//   clock costs a few uA of its own, so it's off unless asked for; without
+//   it, power-down time reads as zero.
+#define ENERGY_ADDR			PROFILE_END
+#define ENERGY_LEN			24		// sizeof(energy_t), for #if.
+#define CURRENT_ADDR		(ENERGY_ADDR + ENERGY_LEN)
+#define CURRENT_SLEEP		0		// Power-down, nA.
+#define CURRENT_IDLE		1		// Awake, nothing going on, uA.
+#define CURRENT_SPI			2		// Awake at 4MHz, talking to the ADXL362, uA.
+#define CURRENT_EEPROM		3		// Awake, programming EEPROM, uA.
+#define CURRENT_UART		4		// Awake, sending serial data, uA.
+#define SLEEP_CLOCK_ADDR	(CURRENT_ADDR + 10)
+#ifdef FEATURE_ENERGY
+#define ENERGY_SPACE		(ENERGY_LEN + 10 + 1)	// All of the above.
+#else
+#define ENERGY_SPACE		0
+#endif
+#define ENERGY_END			(ENERGY_ADDR + ENERGY_SPACE)
+
+#endif
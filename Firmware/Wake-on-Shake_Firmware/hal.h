@@ -0,0 +1,22 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+hal.h
+Hooks for the host (Linux) build; see host/hal.c. On the real part they all
+compile away to nothing.
+******************************************************************************/
+
+#ifndef _hal_h_included
+#define _hal_h_included
+
+#ifdef HAL_HOST
+void halIdle(void);		// Let simulated time pass while main() spins.
+#else
+#define halIdle()
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+host/avr/interrupt.h
+Stand-in for avr-libc's <avr/interrupt.h> for the host build. ISRs become
+plain functions, which hal.c calls when the simulated hardware says they
+should run.
+******************************************************************************/
+
+#ifndef _host_avr_interrupt_h_included
+#define _host_avr_interrupt_h_included
+
+#include <avr/io.h>
+
+#define ISR(vector)		void vector(void); void vector(void)
+#define ISR_ALIAS(vector, target)	void vector(void); \
+								void vector(void) { target(); }
+#define sei()			(SREG |= (1<<SREG_I))
+#define cli()			(SREG &= (uint8_t)~(1<<SREG_I))
+
+#endif
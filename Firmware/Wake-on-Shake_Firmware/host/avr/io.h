@@ -0,0 +1,268 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+host/avr/io.h
+Stand-in for avr-libc's <avr/io.h> for the host (Linux) build. Every register
+name turns into a call to halReg(), which lets the simulated hardware in
+hal.c catch up on whatever the last register access did (shift the USI, send
+a byte out the USART, program the EEPROM...) before handing back the
+register. The firmware source doesn't know the difference.
+******************************************************************************/
+
+#ifndef _host_avr_io_h_included
+#define _host_avr_io_h_included
+
+#include <stdint.h>
+
+// Indices into the simulated I/O register file.
+enum
+{
+	HAL_PINA, HAL_DDRA, HAL_PORTA,
+	HAL_PINB, HAL_DDRB, HAL_PORTB,
+	HAL_PIND, HAL_DDRD, HAL_PORTD,
+	HAL_MCUCR, HAL_GIMSK, HAL_EIFR,
+	HAL_USICR, HAL_USISR, HAL_USIDR,
+	HAL_UBRRH, HAL_UBRRL, HAL_UCSRA, HAL_UCSRB, HAL_UCSRC,
+	HAL_EECR, HAL_EEAR, HAL_EEDR,
+	HAL_TCCR0A, HAL_TCCR0B, HAL_TCNT0, HAL_OCR0A, HAL_OCR0B,
+	HAL_TCCR1A, HAL_TCCR1B, HAL_TCCR1C,
+	HAL_TIMSK, HAL_TIFR,
+	HAL_CLKPR, HAL_PRR, HAL_ACSR, HAL_DIDR, HAL_WDTCSR,
+	HAL_GPIOR0, HAL_GPIOR1, HAL_GPIOR2,
+	HAL_PCMSK, HAL_PCMSK1, HAL_PCMSK2,
+	HAL_SREG,
+	HAL_NREGS
+};
+
+// 16-bit registers live in their own file.
+enum
+{
+	HAL_TCNT1, HAL_OCR1A, HAL_OCR1B, HAL_ICR1,
+	HAL_NREGS16
+};
+
+volatile uint8_t*	halReg(uint8_t);
+volatile uint16_t*	halReg16(uint8_t);
+volatile uint16_t*	halUdr(void);	// UDR is special; see hal.c.
+
+#define PINA	(*halReg(HAL_PINA))
+#define DDRA	(*halReg(HAL_DDRA))
+#define PORTA	(*halReg(HAL_PORTA))
+#define PINB	(*halReg(HAL_PINB))
+#define DDRB	(*halReg(HAL_DDRB))
+#define PORTB	(*halReg(HAL_PORTB))
+#define PIND	(*halReg(HAL_PIND))
+#define DDRD	(*halReg(HAL_DDRD))
+#define PORTD	(*halReg(HAL_PORTD))
+#define MCUCR	(*halReg(HAL_MCUCR))
+#define GIMSK	(*halReg(HAL_GIMSK))
+#define EIFR	(*halReg(HAL_EIFR))
+#define USICR	(*halReg(HAL_USICR))
+#define USISR	(*halReg(HAL_USISR))
+#define USIDR	(*halReg(HAL_USIDR))
+#define UBRRH	(*halReg(HAL_UBRRH))
+#define UBRRL	(*halReg(HAL_UBRRL))
+#define UCSRA	(*halReg(HAL_UCSRA))
+#define UCSRB	(*halReg(HAL_UCSRB))
+#define UCSRC	(*halReg(HAL_UCSRC))
+#define UDR		(*halUdr())
+#define EECR	(*halReg(HAL_EECR))
+#define EEAR	(*halReg(HAL_EEAR))
+#define EEDR	(*halReg(HAL_EEDR))
+#define TCCR0A	(*halReg(HAL_TCCR0A))
+#define TCCR0B	(*halReg(HAL_TCCR0B))
+#define TCNT0	(*halReg(HAL_TCNT0))
+#define OCR0A	(*halReg(HAL_OCR0A))
+#define OCR0B	(*halReg(HAL_OCR0B))
+#define TCCR1A	(*halReg(HAL_TCCR1A))
+#define TCCR1B	(*halReg(HAL_TCCR1B))
+#define TCCR1C	(*halReg(HAL_TCCR1C))
+#define TCNT1	(*halReg16(HAL_TCNT1))
+#define OCR1A	(*halReg16(HAL_OCR1A))
+#define OCR1B	(*halReg16(HAL_OCR1B))
+#define ICR1	(*halReg16(HAL_ICR1))
+#define TIMSK	(*halReg(HAL_TIMSK))
+#define TIFR	(*halReg(HAL_TIFR))
+#define CLKPR	(*halReg(HAL_CLKPR))
+#define PRR		(*halReg(HAL_PRR))
+#define ACSR	(*halReg(HAL_ACSR))
+#define DIDR	(*halReg(HAL_DIDR))
+#define WDTCSR	(*halReg(HAL_WDTCSR))
+#define GPIOR0	(*halReg(HAL_GPIOR0))
+#define GPIOR1	(*halReg(HAL_GPIOR1))
+#define GPIOR2	(*halReg(HAL_GPIOR2))
+#define PCMSK	(*halReg(HAL_PCMSK))
+#define PCMSK1	(*halReg(HAL_PCMSK1))
+#define PCMSK2	(*halReg(HAL_PCMSK2))
+#define SREG	(*halReg(HAL_SREG))
+
+// Bit names, same values as the ATtiny2313A.
+#define PA0		0
+#define PA1		1
+#define PA2		2
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PB5		5
+#define PB6		6
+#define PB7		7
+#define PD0		0
+#define PD1		1
+#define PD2		2
+#define PD3		3
+#define PD4		4
+#define PD5		5
+#define PD6		6
+
+// MCUCR
+#define PUD		7
+#define SM1		6
+#define SE		5
+#define SM0		4
+#define ISC11	3
+#define ISC10	2
+#define ISC01	1
+#define ISC00	0
+
+// GIMSK / EIFR
+#define INT1	7
+#define INT0	6
+#define PCIE0	5
+#define PCIE2	4
+#define PCIE1	3
+#define INTF1	7
+#define INTF0	6
+#define PCIF0	5
+#define PCIF2	4
+#define PCIF1	3
+
+// PCMSK2- port D pin change enables.
+#define PCINT17	6
+#define PCINT16	5
+#define PCINT15	4
+#define PCINT14	3
+#define PCINT13	2
+#define PCINT12	1
+#define PCINT11	0
+
+// USICR / USISR
+#define USISIE	7
+#define USIOIE	6
+#define USIWM1	5
+#define USIWM0	4
+#define USICS1	3
+#define USICS0	2
+#define USICLK	1
+#define USITC	0
+#define USISIF	7
+#define USIOIF	6
+#define USIPF	5
+#define USIDC	4
+
+// UCSRA / UCSRB / UCSRC
+#define RXC		7
+#define TXC		6
+#define UDRE	5
+#define FE		4
+#define DOR		3
+#define UPE		2
+#define U2X		1
+#define MPCM	0
+#define RXCIE	7
+#define TXCIE	6
+#define UDRIE	5
+#define RXEN	4
+#define TXEN	3
+#define UCSZ2	2
+#define RXB8	1
+#define TXB8	0
+#define UMSEL1	7
+#define UMSEL0	6
+#define UPM1	5
+#define UPM0	4
+#define USBS	3
+#define UCSZ1	2
+#define UCSZ0	1
+#define UCPOL	0
+
+// EECR
+#define EEPM1	5
+#define EEPM0	4
+#define EERIE	3
+#define EEMPE	2
+#define EEPE	1
+#define EERE	0
+
+// TCCR0A / TCCR0B / TCCR1B
+#define COM0A1	7
+#define COM0A0	6
+#define COM0B1	5
+#define COM0B0	4
+#define WGM01	1
+#define WGM00	0
+#define FOC0A	7
+#define FOC0B	6
+#define WGM02	3
+#define CS02	2
+#define CS01	1
+#define CS00	0
+#define ICNC1	7
+#define ICES1	6
+#define WGM13	4
+#define WGM12	3
+#define CS12	2
+#define CS11	1
+#define CS10	0
+
+// TIMSK / TIFR
+#define TOIE1	7
+#define OCIE1A	6
+#define OCIE1B	5
+#define ICIE1	3
+#define OCIE0B	2
+#define TOIE0	1
+#define OCIE0A	0
+#define TOV1	7
+#define OCF1A	6
+#define OCF1B	5
+#define ICF1	3
+#define OCF0B	2
+#define TOV0	1
+#define OCF0A	0
+
+// CLKPR
+#define CLKPCE	7
+#define CLKPS3	3
+#define CLKPS2	2
+#define CLKPS1	1
+#define CLKPS0	0
+
+// WDTCSR
+#define WDIF	7
+#define WDIE	6
+#define WDP3	5
+#define WDCE	4
+#define WDE		3
+#define WDP2	2
+#define WDP1	1
+#define WDP0	0
+
+// PRR
+#define PRTIM1	3
+#define PRTIM0	2
+#define PRUSI	1
+#define PRUSART	0
+
+// SREG
+#define SREG_I	7
+
+#define E2END	127
+#define RAMEND	0xDF
+
+#endif
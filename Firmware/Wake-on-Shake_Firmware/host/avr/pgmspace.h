@@ -0,0 +1,25 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+host/avr/pgmspace.h
+Stand-in for avr-libc's <avr/pgmspace.h> for the host build. There's only one
+address space here, so the reads are plain dereferences; that also keeps
+function pointers read with pgm_read_word() at their full host width.
+******************************************************************************/
+
+#ifndef _host_avr_pgmspace_h_included
+#define _host_avr_pgmspace_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p)	(*(p))
+#define pgm_read_word(p)	(*(p))
+#define pgm_read_dword(p)	(*(p))
+
+#endif
@@ -0,0 +1,30 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons 
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask 
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+host/avr/sleep.h
+Stand-in for avr-libc's <avr/sleep.h> for the host build. sleep_cpu() hands
+control to the simulator, which skips ahead to the next wake-up event.
+******************************************************************************/
+
+#ifndef _host_avr_sleep_h_included
+#define _host_avr_sleep_h_included
+
+#include <avr/io.h>
+
+void halSleep(void);
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_PWR_DOWN		(1<<SM0)
+#define SLEEP_MODE_STANDBY		(1<<SM1)
+
+#define set_sleep_mode(mode)	(MCUCR = (MCUCR & ~((1<<SM1) | (1<<SM0))) | (mode))
+#define sleep_enable()			(MCUCR |= (1<<SE))
+#define sleep_disable()			(MCUCR &= (uint8_t)~(1<<SE))
+#define sleep_cpu()				halSleep()
+#define sleep_mode()			do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
@@ -0,0 +1,1041 @@
+/******************************************************************************
+Wake-on-Shake hardware and firmware are released under the Creative Commons
+Share Alike v3.0 license:
+	http://creativecommons.org/licenses/by-sa/3.0/
+Feel free to use, distribute, and sell variants of Wake-on-Shake. All we ask
+is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
+
+host/hal.c
+Simulated Wake-on-Shake hardware for the host (Linux) build. The firmware
+runs unmodified on top of this; see host/avr/io.h for how register accesses
+end up here. What's simulated:
+  - the CPU clock (8MHz RC through CLKPR; the fuses start it at 1MHz), with
+    every register access costing one cycle,
+  - Timer0 and Timer1 (overflow and compare-match A),
+  - the USART: stdin is sent to the firmware at 9600 baud, and whatever the
+    firmware sends comes out on stdout. The host side obeys XON/XOFF, and
+    they don't go to stdout,
+  - the USI in three-wire mode, with an ADXL362 on the other end of it,
+  - the EEPROM, including the split erase/write modes and EE_READY,
+  - the watchdog, in interrupt mode,
+  - sleep modes, INT0 (the RX line) and INT1 (the ADXL362's INT1 pin), and
+    the pin change interrupt on PD3.
+
+Usage: wake-on-shake-host [options] < script
+  -e file        Load EEPROM from file at start, save it back at exit.
+  -s ms[:mg[:len]]  Shake the board at time ms, mg hard (default 500), for
+                 len ms (default 300). Can be repeated.
+  -d ms          Wait this long before sending stdin (default 100).
+  -g n:ms        Pause this long before sending byte n of stdin (counting
+                 from 0), to test timeouts.
+  -t ms          Give up after this much simulated time (default 3600000).
+  -v             Trace wakes, sleeps, and SPI transactions to stderr.
+
+As on the real board, the byte that wakes the part up from power-down is
+lost, so start scripts with a throwaway character if the part might be
+asleep. The simulation ends when the part is asleep and there's nothing
+left that could wake it up.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <avr/io.h>
+#include "../xl362.h"
+
+// The firmware's main() gets renamed on the command line; this file's
+//   main() is the real one.
+#undef main
+int firmwareMain(void);
+
+// The firmware doesn't have to provide every ISR, so these are weak; an
+//   interrupt with no handler just gets dropped (on the real part it would
+//   reset the processor).
+#define HAL_VECTOR(v)	extern void v(void) __attribute__((weak))
+HAL_VECTOR(INT0_vect);
+HAL_VECTOR(INT1_vect);
+HAL_VECTOR(TIMER1_COMPA_vect);
+HAL_VECTOR(TIMER1_OVF_vect);
+HAL_VECTOR(TIMER0_OVF_vect);
+HAL_VECTOR(USART_RX_vect);
+HAL_VECTOR(USART_UDRE_vect);
+HAL_VECTOR(TIMER0_COMPA_vect);
+HAL_VECTOR(EEPROM_READY_vect);
+HAL_VECTOR(WDT_OVERFLOW_vect);
+HAL_VECTOR(PCINT_D_vect);
+
+#define NEVER			0xFFFFFFFFFFFFFFFFULL
+#define RC_OSC_NS		125				// The 8MHz internal oscillator.
+#define HOST_BYTE_NS	1041667ULL		// One 8-N-1 byte at 9600 baud.
+#define UDR_EMPTY		0x100			// Not a byte; see halUdr().
+#define HOST_XON		0x11
+#define HOST_XOFF		0x13
+#define MAX_SHAKES		32
+
+// ----------------------------------------------------------------------------
+// Simulator state.
+
+static volatile uint8_t		io[HAL_NREGS];
+static volatile uint16_t	io16[HAL_NREGS16];
+static volatile uint16_t	udr = UDR_EMPTY;
+
+static uint64_t		nanos = 0;			// Simulated time since power-up.
+static uint64_t		cycles = 0;			// CPU cycles since power-up.
+static uint64_t		limitNs = 3600000000000ULL;
+static int			verbose = 0;
+static int			depth = 0;			// > 0 while the simulator itself is
+										//   touching registers.
+static int			isrDepth = 0;
+
+static uint8_t		lastPortB = 0;
+static uint8_t		clkps = 3;			// CKDIV8 is programmed, so the clock
+										//   starts at 8MHz/8.
+static uint8_t		clkpce = 0;
+static uint32_t		timer0Prescale = 0;
+static uint32_t		timer1Prescale = 0;
+
+// USART
+static uint8_t		txShifting = 0;		// Byte in the shift register.
+static uint16_t		txWaitingByte = 0;	// 0x100 | byte waiting in UDR.
+static uint64_t		txDoneCycle = 0;
+static uint8_t		txcFlag = 0;
+static uint8_t		rxFull = 0;
+static uint8_t		rxByte = 0;
+static uint8_t		rxLoaded = 0;
+static uint8_t*		rxData = NULL;		// Everything from stdin.
+static size_t		rxLen = 0;
+static size_t		rxPos = 0;
+static uint64_t		rxNextNs = 100000000ULL;
+static uint8_t		rxPaused = 0;		// XOFF seen, and no XON since.
+static uint64_t		rxPauseNs = 0;		// When the host got the XOFF.
+static size_t		gapPos = (size_t)-1;	// See -g.
+static uint64_t		gapNs = 0;
+static uint64_t		int0LowUntilNs = 0;
+
+// Wake-up latency: when the INT pin that woke the part went low, and
+//   whether the load and the wake mark were on last time we looked.
+static uint64_t		wakePinNs = NEVER;
+static uint8_t		loadWasOn = 0;
+static uint8_t		markWasOn = 0;
+
+// Watchdog (interrupt mode only; it never resets the part).
+static uint64_t		wdtNextNs = NEVER;
+
+// EEPROM
+static uint8_t		eeprom[E2END + 1];
+static const char*	eepromFile = NULL;
+static uint64_t		eeDoneNs = 0;
+static uint8_t		eeBusy = 0;			// EEPE is set because of programming.
+
+// ADXL362
+typedef struct
+{
+	uint64_t	startNs;
+	uint64_t	endNs;
+	int16_t		mg;
+} shake_t;
+
+static shake_t		shakes[MAX_SHAKES];
+static int			shakeCount = 0;
+
+static struct
+{
+	uint8_t		regs[0x40];
+	uint8_t		state;					// 0 command, 1 address, 2 data.
+	uint8_t		cmd;
+	uint8_t		addr;
+	uint8_t		bit;					// USI bit count within the byte.
+	uint8_t		outByte;				// Byte the ADXL362 is sending.
+	uint8_t		inByte;					// Byte the AVR is sending.
+	uint8_t		fifoHalf;				// Next FIFO byte is the high one.
+	uint16_t	fifo[512];
+	uint16_t	fifoHead;
+	uint16_t	fifoCount;
+	uint16_t	fifoOut;				// Sample being read out of the FIFO.
+	int16_t		data[3];				// Latest X, Y, Z, in mg.
+	uint16_t	actCount;
+	uint16_t	inactCount;
+	uint8_t		lookingForInact;
+	uint64_t	nextSampleNs;
+} adxl;
+
+// ----------------------------------------------------------------------------
+// Odds and ends.
+
+static void trace(const char* fmt, const char* what, unsigned value)
+{
+	if (!verbose) return;
+	fprintf(stderr, "[%10.3f ms] ", nanos / 1e6);
+	fprintf(stderr, fmt, what, value);
+	fputc('\n', stderr);
+}
+
+static uint64_t cpuPeriodNs(void)
+{
+	return (uint64_t)RC_OSC_NS << clkps;
+}
+
+static void saveEeprom(void)
+{
+	FILE* f;
+	if (eepromFile == NULL) return;
+	f = fopen(eepromFile, "wb");
+	if (f == NULL) return;
+	fwrite(eeprom, 1, sizeof(eeprom), f);
+	fclose(f);
+}
+
+static void halExit(const char* why)
+{
+	fflush(stdout);
+	if (verbose) fprintf(stderr, "[%10.3f ms] simulation ends: %s\n", nanos / 1e6, why);
+	saveEeprom();
+	exit(0);
+}
+
+// ----------------------------------------------------------------------------
+// ADXL362.
+
+static uint16_t adxlWord(uint8_t lowAddr)
+{
+	return adxl.regs[lowAddr] | ((uint16_t)adxl.regs[lowAddr + 1] << 8);
+}
+
+static void adxlReset(void)
+{
+	memset(adxl.regs, 0, sizeof(adxl.regs));
+	adxl.regs[XL362_DEVID_AD] = 0xAD;
+	adxl.regs[XL362_DEVID_MST] = 0x1D;
+	adxl.regs[XL362_PARTID] = 0xF2;
+	adxl.regs[XL362_REVID] = 0x02;
+	adxl.regs[XL362_FIFO_SAMPLES] = 0x80;
+	adxl.regs[XL362_FILTER_CTL] = 0x13;
+	adxl.regs[XL362_STATUS] = XL362_INT_AWAKE;
+	adxl.fifoHead = adxl.fifoCount = 0;
+	adxl.actCount = adxl.inactCount = 0;
+	adxl.lookingForInact = 0;
+	adxl.nextSampleNs = nanos;
+}
+
+static uint8_t adxlMeasuring(void)
+{
+	return (adxl.regs[XL362_POWER_CTL] & 0x03) == XL362_MEASURE_3D;
+}
+
+// Time between samples. In wake-up mode, the part only samples about six
+//   times a second until it sees activity.
+static uint64_t adxlSamplePeriod(void)
+{
+	uint8_t rate = adxl.regs[XL362_FILTER_CTL] & 0x07;
+	if (rate > XL362_RATE_400) rate = XL362_RATE_400;
+	if ((adxl.regs[XL362_POWER_CTL] & XL362_SLEEP) &&
+		((adxl.regs[XL362_STATUS] & XL362_INT_AWAKE) == 0)) return 1000000000ULL / 6;
+	return 80000000ULL >> rate;		// 12.5Hz << rate
+}
+
+// Counts per g depend on the range setting.
+static int16_t adxlScale(int16_t mg)
+{
+	switch (adxl.regs[XL362_FILTER_CTL] & 0xC0)
+	{
+		case XL362_RANGE_4G: return mg / 2;
+		case XL362_RANGE_8G: return mg / 4;
+		default:             return mg;
+	}
+}
+
+// The board sits flat (1g on Z) unless it's being shaken; a shake is a 20Hz
+//   triangle wave on X, with a bit of it leaking into Y.
+static void adxlMotion(void)
+{
+	int i;
+	int32_t phase;
+	adxl.data[0] = 0;
+	adxl.data[1] = 0;
+	adxl.data[2] = 1000;
+	for (i = 0; i < shakeCount; i++)
+	{
+		if ((nanos < shakes[i].startNs) || (nanos >= shakes[i].endNs)) continue;
+		phase = (int32_t)(((nanos - shakes[i].startNs) / 1000000ULL) % 50);
+		phase = (phase < 25) ? phase : 50 - phase;		// 0..25..0
+		adxl.data[0] += (int16_t)((shakes[i].mg * (phase * 4 - 50)) / 50);
+		adxl.data[1] += (int16_t)((shakes[i].mg * (phase * 4 - 50)) / 200);
+	}
+}
+
+static void adxlFifoPush(uint16_t sample)
+{
+	adxl.fifo[adxl.fifoHead] = sample;
+	adxl.fifoHead = (adxl.fifoHead + 1) & 511;
+	if (adxl.fifoCount < 512) adxl.fifoCount++;
+}
+
+static uint16_t adxlFifoPop(void)
+{
+	uint16_t sample;
+	if (adxl.fifoCount == 0) return 0;
+	sample = adxl.fifo[(adxl.fifoHead - adxl.fifoCount) & 511];
+	adxl.fifoCount--;
+	return sample;
+}
+
+// One trip through the ADXL362's measurement loop: take a sample, update the
+//   data registers and FIFO, and run activity/inactivity detection.
+static void adxlSample(void)
+{
+	int axis;
+	int16_t counts;
+	uint16_t maxDelta = 0;
+	uint16_t delta;
+	uint8_t actInactCtl = adxl.regs[XL362_ACT_INACT_CTL];
+	uint8_t loop = (actInactCtl & (XL362_ACT_INACT_LINK | XL362_ACT_INACT_LOOP)) != 0;
+	uint16_t fifoWatermark;
+	uint8_t timeAct;
+
+	adxlMotion();
+	for (axis = 0; axis < 3; axis++)
+	{
+		counts = adxlScale(adxl.data[axis]);
+		adxl.regs[XL362_XDATAL + axis*2] = (uint8_t)counts;
+		adxl.regs[XL362_XDATAH + axis*2] = (uint8_t)(counts >> 8) & 0x0F;
+		if (counts < 0) adxl.regs[XL362_XDATAH + axis*2] |= 0xF0;
+		adxl.regs[XL362_XDATA8 + axis] = (uint8_t)(counts >> 4);
+		if ((adxl.regs[XL362_FIFO_CONTROL] & 0x03) != XL362_FIFO_MODE_OFF)
+		{
+			adxlFifoPush(((uint16_t)axis << 14) | ((uint16_t)counts & 0x3FFF));
+		}
+		// Compare against the resting position (0, 0, 1g); close enough to
+		//   referenced mode for our purposes.
+		delta = (uint16_t)abs(counts - ((axis == 2) ? adxlScale(1000) : 0));
+		if (delta > maxDelta) maxDelta = delta;
+	}
+
+	// Activity needs TIME_ACT + 1 samples over the threshold (just one in
+	//   wake-up mode, which ignores TIME_ACT); inactivity needs TIME_INACT
+	//   samples under it.
+	timeAct = (adxl.regs[XL362_POWER_CTL] & XL362_SLEEP) ? 0 : adxl.regs[XL362_TIME_ACT];
+	if ((actInactCtl & XL362_ACT_ENABLE) && (!loop || !adxl.lookingForInact))
+	{
+		if (maxDelta > (adxlWord(XL362_THRESH_ACTL) & 0x07FF))
+		{
+			if (++adxl.actCount > timeAct)
+			{
+				if ((adxl.regs[XL362_STATUS] & XL362_INT_ACT) == 0) trace("%s", "ADXL362 activity", 0);
+				adxl.regs[XL362_STATUS] |= XL362_INT_ACT | XL362_INT_AWAKE;
+				if (loop) adxl.regs[XL362_STATUS] &= ~XL362_INT_INACT;
+				adxl.lookingForInact = 1;
+				adxl.inactCount = 0;
+			}
+		}
+		else adxl.actCount = 0;
+	}
+	if ((actInactCtl & XL362_INACT_ENABLE) && (!loop || adxl.lookingForInact))
+	{
+		if (maxDelta < (adxlWord(XL362_THRESH_INACTL) & 0x07FF))
+		{
+			if (++adxl.inactCount >= adxlWord(XL362_TIME_INACTL))
+			{
+				if ((adxl.regs[XL362_STATUS] & XL362_INT_INACT) == 0) trace("%s", "ADXL362 inactivity", 0);
+				adxl.regs[XL362_STATUS] |= XL362_INT_INACT;
+				adxl.regs[XL362_STATUS] &= ~XL362_INT_AWAKE;
+				if (loop) adxl.regs[XL362_STATUS] &= ~XL362_INT_ACT;
+				adxl.lookingForInact = 0;
+				adxl.actCount = 0;
+			}
+		}
+		else adxl.inactCount = 0;
+	}
+
+	adxl.regs[XL362_STATUS] |= XL362_INT_DATA_READY;
+	fifoWatermark = adxl.regs[XL362_FIFO_SAMPLES];
+	if (adxl.regs[XL362_FIFO_CONTROL] & XL362_FIFO_SAMPLES_AH) fifoWatermark += 256;
+	if (adxl.fifoCount >= fifoWatermark) adxl.regs[XL362_STATUS] |= XL362_INT_FIFO_WATERMARK;
+	else adxl.regs[XL362_STATUS] &= ~XL362_INT_FIFO_WATERMARK;
+	if (adxl.fifoCount) adxl.regs[XL362_STATUS] |= XL362_INT_FIFO_READY;
+	else adxl.regs[XL362_STATUS] &= ~XL362_INT_FIFO_READY;
+}
+
+// Catch the ADXL362 up to the current time.
+static void adxlRun(void)
+{
+	if (!adxlMeasuring())
+	{
+		adxl.nextSampleNs = nanos;
+		return;
+	}
+	while (adxl.nextSampleNs <= nanos)
+	{
+		adxlSample();
+		adxl.nextSampleNs += adxlSamplePeriod();
+	}
+}
+
+// Level of the ADXL362's INT1 pin.
+static uint8_t adxlInt1Pin(void)
+{
+	uint8_t map = adxl.regs[XL362_INTMAP1];
+	uint8_t asserted = (adxl.regs[XL362_STATUS] & map & 0x7F) != 0;
+	if (map & XL362_INT_LOW) return !asserted;
+	return asserted;
+}
+
+// Registers that are worked out when they're read.
+static uint8_t adxlRead(uint8_t addr)
+{
+	uint8_t value;
+	addr &= 0x3F;
+	if (addr == XL362_FIFO_ENTRIES_L) return (uint8_t)adxl.fifoCount;
+	if (addr == XL362_FIFO_ENTRIES_H) return (uint8_t)(adxl.fifoCount >> 8);
+	value = adxl.regs[addr];
+	if (addr == XL362_STATUS)
+	{
+		// Reading STATUS acknowledges activity/inactivity, unless the
+		//   part is in loop mode, where they acknowledge each other.
+		if ((adxl.regs[XL362_ACT_INACT_CTL] & XL362_ACT_INACT_LOOP) == 0)
+		{
+			adxl.regs[XL362_STATUS] &= ~(XL362_INT_ACT | XL362_INT_INACT);
+		}
+		adxl.regs[XL362_STATUS] &= ~XL362_INT_DATA_READY;
+	}
+	// Reading the data clears DATA_READY, too, 8-bit or 12-bit.
+	if (((addr >= XL362_XDATA8) && (addr <= XL362_ZDATA8)) ||
+		((addr >= XL362_XDATAL) && (addr <= XL362_ZDATAH)))
+	{
+		adxl.regs[XL362_STATUS] &= ~XL362_INT_DATA_READY;
+	}
+	return value;
+}
+
+static void adxlWrite(uint8_t addr, uint8_t data)
+{
+	addr &= 0x3F;
+	if ((addr == XL362_SOFT_RESET) && (data == XL362_SOFT_RESET_KEY))
+	{
+		adxlReset();
+		return;
+	}
+	if ((addr < XL362_THRESH_ACTL) || (addr > XL362_SELF_TEST)) return;
+	if ((addr == XL362_POWER_CTL) && !adxlMeasuring()) adxl.nextSampleNs = nanos;
+	if ((addr == XL362_ACT_INACT_CTL) || (addr == XL362_POWER_CTL))
+	{
+		adxl.lookingForInact = 0;		// Changing modes re-arms activity.
+		adxl.actCount = adxl.inactCount = 0;
+	}
+	adxl.regs[addr] = data;
+}
+
+// What the ADXL362 shifts out during the next byte.
+static uint8_t adxlRespond(void)
+{
+	if (adxl.state != 2) return 0;
+	if (adxl.cmd == XL362_REG_READ) return adxlRead(adxl.addr);
+	if (adxl.cmd == XL362_FIFO_READ)
+	{
+		if (adxl.fifoHalf == 0) adxl.fifoOut = adxlFifoPop();
+		return adxl.fifoHalf ? (uint8_t)(adxl.fifoOut >> 8) : (uint8_t)adxl.fifoOut;
+	}
+	return 0;
+}
+
+// The ADXL362 has received a whole byte.
+static void adxlReceive(uint8_t data)
+{
+	switch (adxl.state)
+	{
+		case 0:
+		adxl.cmd = data;
+		adxl.fifoHalf = 0;
+		adxl.state = (data == XL362_FIFO_READ) ? 2 : 1;
+		break;
+		case 1:
+		adxl.addr = data;
+		adxl.state = 2;
+		break;
+		default:
+		if (adxl.cmd == XL362_REG_WRITE) adxlWrite(adxl.addr, data);
+		if (adxl.cmd == XL362_FIFO_READ) adxl.fifoHalf ^= 1;
+		else adxl.addr++;
+		break;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Peripherals.
+
+static const uint16_t timerPrescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static void runTimers(uint32_t n)
+{
+	uint32_t prescale = timerPrescale[io[HAL_TCCR1B] & 0x07];
+	uint32_t ticks;
+	uint32_t count;
+	if (prescale && !(io[HAL_PRR] & (1<<PRTIM1)))
+	{
+		timer1Prescale += n;
+		ticks = timer1Prescale / prescale;
+		timer1Prescale %= prescale;
+		while (ticks--)
+		{
+			count = io16[HAL_TCNT1] + 1;
+			if ((io[HAL_TCCR1B] & (1<<WGM12)) && (io16[HAL_TCNT1] == io16[HAL_OCR1A]))
+			{
+				count = 0;		// CTC mode
+			}
+			if (count == io16[HAL_OCR1A]) io[HAL_TIFR] |= (1<<OCF1A);
+			if (count > 0xFFFF) io[HAL_TIFR] |= (1<<TOV1);
+			io16[HAL_TCNT1] = (uint16_t)count;
+		}
+	}
+	prescale = timerPrescale[io[HAL_TCCR0B] & 0x07];
+	if (prescale && !(io[HAL_PRR] & (1<<PRTIM0)))
+	{
+		timer0Prescale += n;
+		ticks = timer0Prescale / prescale;
+		timer0Prescale %= prescale;
+		while (ticks--)
+		{
+			count = io[HAL_TCNT0] + 1;
+			if ((io[HAL_TCCR0A] & (1<<WGM01)) && (io[HAL_TCNT0] == io[HAL_OCR0A]))
+			{
+				count = 0;		// CTC mode
+			}
+			if (count == io[HAL_OCR0A]) io[HAL_TIFR] |= (1<<OCF0A);
+			if (count > 0xFF) io[HAL_TIFR] |= (1<<TOV0);
+			io[HAL_TCNT0] = (uint8_t)count;
+		}
+	}
+}
+
+static uint32_t uartByteCycles(void)
+{
+	uint32_t ubrr = ((uint32_t)(io[HAL_UBRRH] & 0x0F) << 8) | io[HAL_UBRRL];
+	return 10 * (ubrr + 1) * ((io[HAL_UCSRA] & (1<<U2X)) ? 8 : 16);
+}
+
+// Whether the host is ready to start sending the next byte of stdin. A
+//   byte that was already going out when the XOFF arrived still gets sent.
+static int hostSending(void)
+{
+	return (rxPos < rxLen) && !(rxPaused && (rxNextNs >= rxPauseNs));
+}
+
+// A byte from the firmware reaches the host. XOFF takes a byte time to get
+//   there; XON lets the host go again from now.
+static void hostReceive(uint8_t v)
+{
+	if (v == HOST_XOFF)
+	{
+		trace("%s", "XOFF", 0);
+		rxPaused = 1;
+		rxPauseNs = nanos + HOST_BYTE_NS;
+	}
+	else if (v == HOST_XON)
+	{
+		trace("%s", "XON", 0);
+		rxPaused = 0;
+		if (rxNextNs < nanos + HOST_BYTE_NS) rxNextNs = nanos + HOST_BYTE_NS;
+	}
+	else putchar(v);
+}
+
+static void runUart(void)
+{
+	if (txShifting && (cycles >= txDoneCycle))
+	{
+		txShifting = 0;
+		if (txWaitingByte)
+		{
+			hostReceive(txWaitingByte & 0xFF);
+			txWaitingByte = 0;
+			txShifting = 1;
+			txDoneCycle = cycles + uartByteCycles();
+		}
+		else txcFlag = 1;
+	}
+	while (hostSending() && (nanos >= rxNextNs))
+	{
+		if ((io[HAL_UCSRB] & (1<<RXEN)) && !rxFull)
+		{
+			rxByte = rxData[rxPos];
+			rxFull = 1;
+		}
+		else trace("%s byte %u lost", "USART overrun:", rxPos);
+		rxPos++;				// If rxFull was set, that's an overrun.
+		rxNextNs += HOST_BYTE_NS;
+		if (rxPos == gapPos) rxNextNs += gapNs;
+	}
+}
+
+// The watchdog runs off its own 128kHz oscillator: 2048 << WDP cycles.
+static uint64_t wdtPeriodNs(void)
+{
+	uint8_t v = io[HAL_WDTCSR];
+	uint8_t p = (v & 0x07) | ((v & (1<<WDP3)) >> 2);
+	return (16000000ULL << p);
+}
+
+static void runWdt(void)
+{
+	if (nanos >= wdtNextNs)
+	{
+		io[HAL_WDTCSR] |= (1<<WDIF);
+		wdtNextNs += wdtPeriodNs();
+	}
+}
+
+static void runEeprom(void)
+{
+	if (eeBusy && (nanos >= eeDoneNs))
+	{
+		io[HAL_EECR] &= ~(1<<EEPE);
+		eeBusy = 0;
+	}
+}
+
+// Everything that happens just because time goes by.
+static void advance(uint32_t n)
+{
+	cycles += n;
+	nanos += n * cpuPeriodNs();
+	runTimers(n);
+	runUart();
+	runEeprom();
+	runWdt();
+	adxlRun();
+	if (nanos > limitNs) halExit("time limit");
+}
+
+// ----------------------------------------------------------------------------
+// Register side effects.
+
+static void settleWrites(void)
+{
+	uint8_t v;
+	uint8_t mode;
+
+	// Chip select for the ADXL362 is PB4.
+	v = io[HAL_PORTB];
+	if ((lastPortB & (1<<PB4)) && !(v & (1<<PB4)))
+	{
+		adxl.state = 0;
+		adxl.bit = 0;
+	}
+	lastPortB = v;
+
+	// USI- a USICLK strobe (with no clock source selected) shifts one bit.
+	v = io[HAL_USICR];
+	if ((v & (1<<USICLK)) && ((v & ((1<<USICS1) | (1<<USICS0))) == 0) &&
+		!(io[HAL_PRR] & (1<<PRUSI)))
+	{
+		if (adxl.bit == 0)
+		{
+			adxl.inByte = io[HAL_USIDR];
+			adxl.outByte = (io[HAL_PORTB] & (1<<PB4)) ? 0xFF : adxlRespond();
+		}
+		io[HAL_USIDR] = (io[HAL_USIDR] << 1) | ((adxl.outByte >> (7 - adxl.bit)) & 1);
+		if (++adxl.bit == 8)
+		{
+			adxl.bit = 0;
+			io[HAL_USISR] |= (1<<USIOIF);
+			if (!(io[HAL_PORTB] & (1<<PB4))) adxlReceive(adxl.inByte);
+		}
+	}
+	io[HAL_USICR] = v & ~((1<<USICLK) | (1<<USITC));
+
+	// USART transmit.
+	if (!rxLoaded && (udr != UDR_EMPTY))
+	{
+		v = (uint8_t)udr;
+		udr = UDR_EMPTY;
+		txcFlag = 0;
+		if (!(io[HAL_UCSRB] & (1<<TXEN))) {}
+		else if (!txShifting)
+		{
+			hostReceive(v);
+			txShifting = 1;
+			txDoneCycle = cycles + uartByteCycles();
+		}
+		else txWaitingByte = 0x100 | v;
+	}
+	io[HAL_UCSRA] = (io[HAL_UCSRA] & ((1<<U2X) | (1<<MPCM))) |
+		(rxFull ? (1<<RXC) : 0) | (txcFlag ? (1<<TXC) : 0) |
+		(txWaitingByte ? 0 : (1<<UDRE));
+
+	// EEPROM
+	v = io[HAL_EECR];
+	if ((v & (1<<EEPE)) && !eeBusy && (v & (1<<EEMPE)))
+	{
+		mode = (v >> EEPM0) & 0x03;
+		switch (mode)
+		{
+			case 0: eeprom[io[HAL_EEAR] & E2END] = io[HAL_EEDR]; break;
+			case 1: eeprom[io[HAL_EEAR] & E2END] = 0xFF; break;
+			case 2: eeprom[io[HAL_EEAR] & E2END] &= io[HAL_EEDR]; break;
+		}
+		eeDoneNs = nanos + ((mode == 0) ? 3400000ULL : 1800000ULL);
+		eeBusy = 1;
+		v &= ~(1<<EEMPE);
+	}
+	else if ((v & (1<<EEPE)) && !eeBusy) v &= ~(1<<EEPE);	// No EEMPE first.
+	if (v & (1<<EERE))
+	{
+		io[HAL_EEDR] = eeprom[io[HAL_EEAR] & E2END];
+		v &= ~(1<<EERE);
+	}
+	io[HAL_EECR] = v;
+
+	// Watchdog- starts counting when WDIE is turned on.
+	if (!(io[HAL_WDTCSR] & (1<<WDIE))) wdtNextNs = NEVER;
+	else if (wdtNextNs == NEVER) wdtNextNs = nanos + wdtPeriodNs();
+
+	// CLKPR- the prescaler only changes if CLKPCE was written first.
+	v = io[HAL_CLKPR];
+	if (v != (clkps | clkpce))
+	{
+		if (v & (1<<CLKPCE)) clkpce = (1<<CLKPCE);
+		else if (clkpce)
+		{
+			clkps = v & 0x0F;
+			clkpce = 0;
+		}
+	}
+	io[HAL_CLKPR] = clkps | clkpce;
+
+	// Input pins. PD3 is the ADXL362's INT1, PD2 and PD0 are the RX line.
+	io[HAL_PINA] = io[HAL_PORTA];
+	io[HAL_PINB] = io[HAL_PORTB];
+	v = io[HAL_PORTD] | (1<<PD3) | (1<<PD2) | (1<<PD0);
+	if (!adxlInt1Pin()) v &= ~(1<<PD3);
+	if (nanos < int0LowUntilNs) v &= ~((1<<PD2) | (1<<PD0));
+	if ((v ^ io[HAL_PIND]) & io[HAL_PCMSK2]) io[HAL_EIFR] |= (1<<PCIF2);
+	io[HAL_PIND] = v;
+
+	// The FEATURE_WAKE_MARK probe on PB0. It comes on ahead of the load, and
+	//   is timed the same way.
+	if ((io[HAL_PORTB] & (1<<PB0)) && !markWasOn && (wakePinNs != NEVER))
+	{
+		trace("%s %u us after the wake pin", "wake mark",
+			(unsigned)((nanos - wakePinNs) / 1000));
+	}
+	markWasOn = (io[HAL_PORTB] & (1<<PB0)) != 0;
+
+	// The load switch, PD4. After a wake-up, say how long it took to come
+	//   on after the INT pin went low; that's the delay the user sees.
+	if ((io[HAL_PORTD] & (1<<PD4)) && !loadWasOn && (wakePinNs != NEVER))
+	{
+		trace("%s %u us after the wake pin", "load on",
+			(unsigned)((nanos - wakePinNs) / 1000));
+		wakePinNs = NEVER;
+	}
+	loadWasOn = (io[HAL_PORTD] & (1<<PD4)) != 0;
+}
+
+// Runs an ISR the way the hardware would: with interrupts off.
+static void callIsr(void (*isr)(void), const char* name)
+{
+	if (isr == NULL)
+	{
+		trace("no handler for %s", name, 0);
+		return;
+	}
+	io[HAL_SREG] &= ~(1<<SREG_I);
+	isrDepth++;
+	advance(8);					// Interrupt response and RETI.
+	isr();
+	isrDepth--;
+	io[HAL_SREG] |= (1<<SREG_I);
+}
+
+// Find the highest priority interrupt that's ready to go, and run it.
+static int deliverInterrupt(void)
+{
+	uint8_t gimsk = io[HAL_GIMSK];
+	if (!(io[HAL_SREG] & (1<<SREG_I)) || (isrDepth != 0)) return 0;
+	if ((gimsk & (1<<INT0)) && !(io[HAL_PIND] & (1<<PD2)))
+	{
+		callIsr(INT0_vect, "INT0");
+		return 1;
+	}
+	if ((gimsk & (1<<INT1)) && !(io[HAL_PIND] & (1<<PD3)))
+	{
+		callIsr(INT1_vect, "INT1");
+		return 1;
+	}
+	if ((io[HAL_TIMSK] & (1<<OCIE1A)) && (io[HAL_TIFR] & (1<<OCF1A)))
+	{
+		io[HAL_TIFR] &= ~(1<<OCF1A);
+		callIsr(TIMER1_COMPA_vect, "TIMER1_COMPA");
+		return 1;
+	}
+	if ((io[HAL_TIMSK] & (1<<TOIE1)) && (io[HAL_TIFR] & (1<<TOV1)))
+	{
+		io[HAL_TIFR] &= ~(1<<TOV1);
+		callIsr(TIMER1_OVF_vect, "TIMER1_OVF");
+		return 1;
+	}
+	if ((io[HAL_TIMSK] & (1<<TOIE0)) && (io[HAL_TIFR] & (1<<TOV0)))
+	{
+		io[HAL_TIFR] &= ~(1<<TOV0);
+		callIsr(TIMER0_OVF_vect, "TIMER0_OVF");
+		return 1;
+	}
+	if ((io[HAL_UCSRB] & (1<<RXCIE)) && rxFull)
+	{
+		// The ISR reads the byte out of UDR, which clears RXC.
+		rxLoaded = 1;
+		udr = rxByte;
+		callIsr(USART_RX_vect, "USART_RX");
+		if (rxLoaded) udr = UDR_EMPTY;
+		rxLoaded = 0;
+		rxFull = 0;
+		return 1;
+	}
+	if ((io[HAL_UCSRB] & (1<<UDRIE)) && !txWaitingByte)
+	{
+		callIsr(USART_UDRE_vect, "USART_UDRE");
+		return 1;
+	}
+	if ((io[HAL_TIMSK] & (1<<OCIE0A)) && (io[HAL_TIFR] & (1<<OCF0A)))
+	{
+		io[HAL_TIFR] &= ~(1<<OCF0A);
+		callIsr(TIMER0_COMPA_vect, "TIMER0_COMPA");
+		return 1;
+	}
+	if ((io[HAL_EECR] & (1<<EERIE)) && !(io[HAL_EECR] & (1<<EEPE)))
+	{
+		callIsr(EEPROM_READY_vect, "EEPROM_READY");
+		return 1;
+	}
+	if ((io[HAL_WDTCSR] & (1<<WDIE)) && (io[HAL_WDTCSR] & (1<<WDIF)))
+	{
+		io[HAL_WDTCSR] &= ~(1<<WDIF);
+		callIsr(WDT_OVERFLOW_vect, "WDT_OVERFLOW");
+		return 1;
+	}
+	if ((gimsk & (1<<PCIE2)) && (io[HAL_EIFR] & (1<<PCIF2)))
+	{
+		io[HAL_EIFR] &= ~(1<<PCIF2);
+		callIsr(PCINT_D_vect, "PCINT_D");
+		return 1;
+	}
+	return 0;
+}
+
+// Bring everything up to date before the firmware touches a register.
+static void settle(void)
+{
+	if (depth) return;
+	depth++;
+	advance(1);
+	settleWrites();
+	depth--;
+	while (deliverInterrupt())
+	{
+		depth++;
+		settleWrites();
+		depth--;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// What the firmware sees.
+
+volatile uint8_t* halReg(uint8_t reg)
+{
+	settle();
+	return &io[reg];
+}
+
+volatile uint16_t* halReg16(uint8_t reg)
+{
+	settle();
+	return &io16[reg];
+}
+
+// UDR is really two registers- transmit and receive- at one address. A
+//   write leaves a byte (not UDR_EMPTY) behind, which the next settle()
+//   sends. Received bytes are only ever read from inside the RX ISR, where
+//   rxLoaded says what's in there is incoming. The ISR reads UDR first, so
+//   any later access there (XOFF going out) is a write.
+volatile uint16_t* halUdr(void)
+{
+	if (rxLoaded == 2)
+	{
+		udr = UDR_EMPTY;
+		rxLoaded = 0;
+	}
+	else if (rxLoaded) rxLoaded = 2;
+	settle();
+	return &udr;
+}
+
+// Lets simulated time pass while main() spins, waiting for an interrupt.
+void halIdle(void)
+{
+	depth++;
+	advance(16);
+	depth--;
+	settle();
+}
+
+// Sleep. In idle mode, the clocks keep running, so just let time go by until
+//   an interrupt is ready. In power-down, only the INT pins (and the
+//   ADXL362, which has its own clock) are alive; skip ahead to whatever
+//   wakes the part up.
+void halSleep(void)
+{
+	uint64_t next;
+	uint64_t lastShakeNs = 0;
+	int i;
+
+	if (!(io[HAL_MCUCR] & (1<<SE))) return;
+	if (!(io[HAL_SREG] & (1<<SREG_I))) halExit("slept with interrupts off");
+
+	if ((io[HAL_MCUCR] & ((1<<SM1) | (1<<SM0))) == 0)
+	{
+		depth++;
+		do
+		{
+			advance(16);
+			settleWrites();
+		} while (!deliverInterrupt());
+		depth--;
+		settle();
+		return;
+	}
+
+	trace("%s", "power down", 0);
+	for (i = 0; i < shakeCount; i++)
+	{
+		if (shakes[i].endNs > lastShakeNs) lastShakeNs = shakes[i].endNs;
+	}
+	depth++;
+	for (;;)
+	{
+		settleWrites();
+		if (((io[HAL_GIMSK] & (1<<INT0)) && !(io[HAL_PIND] & (1<<PD2))) ||
+			((io[HAL_GIMSK] & (1<<INT1)) && !(io[HAL_PIND] & (1<<PD3))) ||
+			((io[HAL_GIMSK] & (1<<PCIE2)) && (io[HAL_EIFR] & (1<<PCIF2))) ||
+			(io[HAL_WDTCSR] & (1<<WDIF))) break;
+
+		// Next thing that could happen: a byte from the host, or a sample.
+		next = NEVER;
+		if (hostSending()) next = (rxNextNs > nanos) ? rxNextNs : nanos;
+		if (adxlMeasuring() && (adxl.nextSampleNs < next)) next = adxl.nextSampleNs;
+		if (!hostSending() && (nanos > lastShakeNs + 60000000000ULL) &&
+			(adxlInt1Pin() || !(io[HAL_GIMSK] & ((1<<INT1) | (1<<PCIE2))))) next = NEVER;
+		if ((next != NEVER) && (wdtNextNs < next)) next = wdtNextNs;
+		if (next == NEVER) halExit("nothing left to wake up for");
+		if (next > limitNs) halExit("time limit");
+		nanos = next;
+		adxlRun();
+		runWdt();
+
+		// A byte arriving pulls the RX line (and INT0) low. The USART isn't
+		//   running, so the byte itself is lost.
+		if (hostSending() && (nanos >= rxNextNs))
+		{
+			rxPos++;
+			rxNextNs = nanos + HOST_BYTE_NS;
+			if (rxPos == gapPos) rxNextNs += gapNs;
+			int0LowUntilNs = nanos + HOST_BYTE_NS / 10;
+		}
+	}
+	depth--;
+	if (!(io[HAL_PORTD] & (1<<PD4))) wakePinNs = nanos;
+	trace("%s", "wake up", 0);
+	advance(6);					// Start-up time for the RC oscillator.
+	settle();
+}
+
+// ----------------------------------------------------------------------------
+// Start-up.
+
+static void readStdin(void)
+{
+	size_t size = 256;
+	ssize_t got;
+	rxData = malloc(size);
+	while ((got = read(STDIN_FILENO, rxData + rxLen, size - rxLen)) > 0)
+	{
+		rxLen += got;
+		if (rxLen == size) rxData = realloc(rxData, size *= 2);
+	}
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-e eeprom.bin] [-s ms[:mg[:len]]]... "
+		"[-d ms] [-g n:ms] [-t ms] [-v] < script\n", name);
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	FILE* f;
+	unsigned long ms;
+	unsigned long mg;
+	unsigned long len;
+
+	setvbuf(stdout, NULL, _IONBF, 0);	// Keep it in step with the trace.
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	while ((opt = getopt(argc, argv, "e:s:d:g:t:v")) != -1)
+	{
+		switch (opt)
+		{
+			case 'e':
+			eepromFile = optarg;
+			f = fopen(eepromFile, "rb");
+			if (f != NULL)
+			{
+				if (fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom))
+				{
+					fprintf(stderr, "%s: short EEPROM image\n", eepromFile);
+				}
+				fclose(f);
+			}
+			break;
+			case 's':
+			if (shakeCount == MAX_SHAKES) usage(argv[0]);
+			mg = 500;
+			len = 300;
+			if (sscanf(optarg, "%lu:%lu:%lu", &ms, &mg, &len) < 1) usage(argv[0]);
+			shakes[shakeCount].startNs = ms * 1000000ULL;
+			shakes[shakeCount].endNs = (ms + len) * 1000000ULL;
+			shakes[shakeCount].mg = (int16_t)mg;
+			shakeCount++;
+			break;
+			case 'd':
+			rxNextNs = strtoull(optarg, NULL, 0) * 1000000ULL;
+			break;
+			case 'g':
+			if (sscanf(optarg, "%lu:%lu", &len, &ms) != 2) usage(argv[0]);
+			gapPos = len;
+			gapNs = ms * 1000000ULL;
+			break;
+			case 't':
+			limitNs = strtoull(optarg, NULL, 0) * 1000000ULL;
+			break;
+			case 'v':
+			verbose = 1;
+			break;
+			default:
+			usage(argv[0]);
+		}
+	}
+	readStdin();
+
+	// Reset state.
+	io[HAL_CLKPR] = clkps;
+	io[HAL_UCSRA] = (1<<UDRE);
+	io[HAL_UCSRC] = (1<<UCSZ1) | (1<<UCSZ0);
+	io[HAL_PORTB] = 0;
+	lastPortB = 0;
+	adxlReset();
+
+	firmwareMain();
+	halExit("main() returned");
+	return 0;
+}
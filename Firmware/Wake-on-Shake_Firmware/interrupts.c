@@ -18,29 +18,66 @@ we're free to be kind of lax with our response times.
 #include "wake-on-shake.h"
 #include "serial.h"
 #include "eeprom.h"
+#include "energy.h"
 
-extern uint16_t				t1Offset;		// See Wake-on-Shake.cpp
+extern config_t				config;			// See Wake-on-Shake.cpp
 extern volatile uint8_t		sleepyTime;		// See Wake-on-Shake.cpp
-extern volatile uint8_t     serialRxData;	// See Wake-on-Shake.cpp
+#ifdef FEATURE_LONG_WAKE
+extern volatile uint16_t	wakeOverflows;	// See Wake-on-Shake.cpp
+#endif
+extern volatile uint8_t		wakeSource;		// See Wake-on-Shake.cpp
+extern volatile uint8_t		rxBuffer[];		// See serial.c
+extern energyDelta_t			energy;			// See energy.c
+extern uint16_t				t1Start;		// See energy.c
 
 // Timer1 overflow ISR- this is the means by which the device goes to sleep
 //   after it's been on for a certain time. Timer1 has been set up to tick
 //   on clock/1024, which is ~1ms ticks; it's a 16-bit overflow, so left to
 //   it's own devices, it will overflow every 65536 ticks, or after a bit
-//   more than a minute. To shorten that time, we prime TCNT1
+//   more than a minute. To shorten that time, we prime TCNT1; to lengthen
+//   it (FEATURE_LONG_WAKE), we count overflows in wakeOverflows. See
+//   wakeStart().
 ISR(TIMER1_OVF_vect)
 {
+	timer1Overflow();				// Count the trip so far.
+#ifdef FEATURE_LONG_WAKE
+	if (wakeOverflows != 0) wakeOverflows--;
+	else
+#endif
+#if defined(FEATURE_SENSOR_AWAKE) || defined(FEATURE_CONFIRM)
+	if (sleepyTime == FALSE) sleepyTime = TRUE;	// Not SENSOR_AWAKE!
+#else
 	sleepyTime = TRUE;
+#endif
 }
 
+#ifdef FEATURE_FRAMES
+// TIMER1_COMPA ISR- the compare match is set to go off when a partial binary
+//   frame has waited too long for its next byte; the main code does the
+//   rest. See frameWait() in ui.c.
+ISR(TIMER1_COMPA_vect)
+{
+	GPIOR0 &= ~(1<<FLAG_FRAME_WAIT);
+}
+#endif
+
 // INT0 ISR- This is one way the processor can wake from sleep. INT0 is tied
 //   externally to the RX pin, so traffic on the serial receive line will
 //   wake up the part when it is asleep. Note that the receive interrupt
-//   can't wake the processor from sleep- don't try!
+//   can't wake the processor from sleep- don't try! Unless something needs
+//   to tell the two apart, this is just INT1's ISR; see below.
+#if defined(FEATURE_LOG) || defined(FEATURE_SENSOR_AWAKE) || defined(FEATURE_CONFIRM)
 ISR(INT0_vect)
 {
-	TCNT1 = t1Offset;				// Reset our counter for on-time.
+	wakeMarkOn();					// Latency probe, if it's on.
+	loadOn();						// Power to the load comes first; a user
+									//  is waiting on it. Everything else,
+									//  reporting included, can wait.
+	wakeStart();					// Reset our counter for on-time.
 	sleepyTime = FALSE;				// Indicate wakefulness to main loop.
+#ifdef FEATURE_LOG
+	wakeSource = LOG_SERIAL;
+#endif
 	GIMSK = (0<<INT0)|(0<<INT1);	// Disable INT pins while we're awake.
 									//  This is important b/c the INT pins
 									//  cause an interrupt on LOW rather
@@ -48,24 +85,117 @@ ISR(INT0_vect)
 									//  will continue to fire as long as
 									//  the pin is low unless it is disabled.
 }
+#endif
 
 // INT1 ISR- this is the primary way the processor wakes from sleep. INT1 is
 //   tied to the interrupt output pin on the ADXL362, which goes low when
 //   motion is detected.
 ISR(INT1_vect)
 {
-	TCNT1 = t1Offset;				// See INT0 ISR for details.
+	wakeMarkOn();
+#ifdef FEATURE_CONFIRM
+	if (config.confirm == 0) loadOn();	// See INT0 ISR for details. If the
+									//  wake-up needs confirming, the main
+									//  code does it; see wakeConfirm().
+#else
+	loadOn();
+#endif
+	wakeStart();
+#ifdef FEATURE_SENSOR_AWAKE
+	sleepyTime = (config.flags & CONFIG_SENSOR_AWAKE) ? SENSOR_AWAKE : FALSE;
+#else
 	sleepyTime = FALSE;
+#endif
+#ifdef FEATURE_LOG
+	wakeSource = LOG_MOTION;
+#endif
 	GIMSK = (0<<INT0)|(0<<INT1); 
 }
 
+#if !(defined(FEATURE_LOG) || defined(FEATURE_SENSOR_AWAKE) || defined(FEATURE_CONFIRM))
+ISR_ALIAS(INT0_vect, INT1_vect);
+#endif
+
+#if defined(FEATURE_SENSOR_AWAKE) || defined(FEATURE_CONFIRM) || defined(FEATURE_FIFO)
+// PCINT_D ISR- while the ADXL362 is keeping us awake, the pin change
+//   interrupt on its INT1 pin (PD3) is what wakes us up when it goes high at
+//   inactivity. While streaming, it wakes us from the nap in the main loop
+//   when the FIFO watermark is reached. The main code does the rest.
+ISR(PCINT_D_vect)
+{
+}
+#endif
+
+#ifdef FEATURE_STATS
+// TIMER0_COMPA ISR- Timer0 paces the motion statistics samples while we're
+//   awake. The sample itself is SPI work, so the main code does it.
+ISR(TIMER0_COMPA_vect)
+{
+	GPIOR0 |= (1<<FLAG_STATS_DUE);
+}
+#endif
+
 // USART_RX ISR- gets called when the processor is awake and a complete
 //   byte (including stop bit) has been received by the USART. This
 //   interrupt CANNOT be used to wake the processor, so don't try it.
 ISR(USART_RX_vect)
 {
-	TCNT1 = t1Offset;	// Reset the wakefulness timer, so the processor
-						//   doesn't go to sleep while the user is
-						//   interacting with it.
-	serialRxData = UDR; // Pass the data back to the main loop for parsing.
+	wakeLoad();						// Reset the wakefulness timer, so the
+									//   processor doesn't go to sleep while
+									//   the user is interacting with it.
+#ifdef FEATURE_FRAMES
+	GPIOR0 &= ~(1<<FLAG_FRAME_WAIT);	// Have the main code look at the
+									//   buffer again; see frameWait().
+#endif
+	uint8_t nextHead = (rxHead + 1) & RX_BUFFER_MASK;
+	uint8_t data = UDR;	// Always read UDR, even if we have to drop the byte.
+	if (nextHead != rxTail)	// Pass the data back to the main loop for
+	{						//   parsing, unless the buffer is full.
+		rxBuffer[rxHead] = data;
+		rxHead = nextHead;
+	}						// If it is, mark the spot; see RX_OVERRUN.
+	else rxBuffer[(rxHead - 1) & RX_BUFFER_MASK] = RX_OVERRUN;
+	if (((GPIOR0 & (1<<FLAG_RX_PAUSED)) == 0) &&
+		((uint8_t)((rxHead - rxTail) & RX_BUFFER_MASK) >= RX_XOFF_LEVEL))
+	{
+		GPIOR0 |= (1<<FLAG_RX_PAUSED);
+		serialSendNow(XOFF);
+	}
+}
+
+
+// USART_UDRE ISR- fires whenever the transmit data register is empty and
+//   there's something in the transmit buffer to send. serialTxService() hands
+//   the USART the next byte, and turns this interrupt off when we run dry.
+#ifdef FEATURE_TX_BUFFER
+ISR(USART_UDRE_vect)
+{
+	serialTxService();
+}
+#endif
+
+#ifdef FEATURE_EEPROM_QUEUE
+// EE_READY ISR- fires whenever the EEPROM isn't busy and there are queued
+//   writes. EEPROMService() starts the next one, and turns this interrupt off
+//   once the queue is empty.
+ISR(EEPROM_READY_vect)
+{
+	EEPROMService();
+}
+#endif
+
+#ifdef FEATURE_ENERGY
+// WDT ISR- the watchdog only runs while we're asleep, and only if the sleep
+//   clock is turned on; waking up is all it's for. See energyWake(). It also
+//   runs while the ADXL362 holds the load on, and then each period counts as
+//   awake time; see energyHoldStart().
+ISR(WDT_OVERFLOW_vect)
+{
+#ifdef FEATURE_SENSOR_AWAKE
+	if ((sleepyTime == SENSOR_AWAKE) && (PORTD & (1<<PD4)))
+	{
+		energyAdd(awakeTicks, ENERGY_HOLD_TICKS);
+	}
+#endif
 }
+#endif
\ No newline at end of file
@@ -11,21 +11,160 @@ Function implementation for serial write handling.
 ******************************************************************************/
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include <stdio.h>
 #include "serial.h"
+#include "wake-on-shake.h"
+#include "energy.h"
 
-// Print a single character out to the serial port. Blocks until write has
-//   completed- is that a mistake?
+extern energyDelta_t	energy;			// See energy.c
+
+#ifdef FEATURE_TX_BUFFER
+// Transmit ring buffer. serialWriteChar() drops bytes in at txHead, and the
+//   USART_UDRE ISR pulls them out at txTail, so the main loop never has to
+//   sit around waiting for a byte to leave the wire at 9600 baud.
+volatile uint8_t	txBuffer[TX_BUFFER_SIZE];
+volatile uint8_t	txHead = 0;
+volatile uint8_t	txTail = 0;
+#endif
+
+// Receive ring buffer. The USART_RX ISR is the only writer of rxHead and
+//   serialReadChar() is the only writer of rxTail, so neither side needs to
+//   turn interrupts off to use it. The indices live in GPIOR1 and GPIOR2
+//   (see serial.h), which start out zero.
+volatile uint8_t	rxBuffer[RX_BUFFER_SIZE];
+
+#ifdef FEATURE_TX_BUFFER
+// Put a character into the transmit buffer and make sure the UDRE interrupt
+//   is on to drain it. Returns FALSE (and drops nothing) if there's no room.
+uint8_t serialQueueChar(char data)
+{
+	uint8_t nextHead = (txHead + 1) & TX_BUFFER_MASK;
+	if (nextHead == txTail) return FALSE;	// Buffer full.
+	txBuffer[txHead] = data;
+	txHead = nextHead;
+	GPIOR0 |= (1<<FLAG_TX_ACTIVE);
+	UCSRB |= (1<<UDRIE);	// UDRE fires right away if the USART is idle.
+	return TRUE;
+}
+
+// Print a single character out to the serial port. This only blocks if the
+//   transmit buffer is full. If interrupts are off (e.g., during startup) the
+//   UDRE ISR can't empty the buffer for us, so we do it ourselves.
 void serialWriteChar(char data)
 {
-	UDR = data;
+	while (serialQueueChar(data) == FALSE)
+	{
+		if (((SREG & (1<<SREG_I)) == 0) && (UCSRA & (1<<UDRE))) serialTxService();
+	}
+}
+
+// Move the next byte out of the transmit buffer and into the USART. Once the
+//   buffer is empty, the UDRE interrupt gets turned off; otherwise it would
+//   fire continuously, since UDR is empty.
+void serialTxService(void)
+{
+	if (txHead != txTail)
+	{
+		UCSRA |= (1<<TXC);			// Clear "transmit complete" so serialFlush()
+									//   can tell when this byte is done.
+		UDR = txBuffer[txTail];
+		txTail = (txTail + 1) & TX_BUFFER_MASK;
+		energyAdd(uartBytes, 1);
+	}
+	if (txHead == txTail) UCSRB &= ~(1<<UDRIE);
+}
+
+// Wait for the transmit buffer to empty AND for the last byte to finish
+//   shifting out. The USART clock stops in power-down mode, so anything left
+//   in the buffer when we go to sleep would be garbled.
+void serialFlush(void)
+{
+	if ((GPIOR0 & (1<<FLAG_TX_ACTIVE)) == 0) return;	// Nothing sent; TXC
+													//   may never be set.
+	while (txHead != txTail)
+	{
+		if (((SREG & (1<<SREG_I)) == 0) && (UCSRA & (1<<UDRE))) serialTxService();
+	}
+	while ((UCSRA & (1<<TXC))==0){}   // Wait for the transmit to finish.
+	GPIOR0 &= ~(1<<FLAG_TX_ACTIVE);
+}
+#else
+// Print a single character out to the serial port. Blocks until the write
+//   has completed, so there's never anything left over to flush. The receive
+//   ISR may have just put an XOFF in UDR, so wait for it to move on.
+void serialWriteChar(char data)
+{
+	serialSendNow(data);
 	while ((UCSRA & (1<<TXC))==0){}   // Wait for the transmit to finish.
 	UCSRA |= (1<<TXC);				// Clear the "transmit complete" flag.
+	energyAdd(uartBytes, 1);
 }
+#endif
+
+// Returns TRUE if the receive ISR has put anything in the buffer that we
+//   haven't read yet.
+uint8_t serialAvailable(void)
+{
+	return (rxHead != rxTail);
+}
+
+// How many received bytes are waiting in the buffer.
+uint8_t serialCount(void)
+{
+	return (rxHead - rxTail) & RX_BUFFER_MASK;
+}
+
+#ifdef FEATURE_FRAMES
+// Look at a received byte without taking it out of the buffer; offset 0 is
+//   the oldest. Check serialCount() first.
+uint8_t serialPeek(uint8_t offset)
+{
+	return rxBuffer[(rxTail + offset) & RX_BUFFER_MASK];
+}
+#endif
+
+// Once the buffer has drained to RX_XON_LEVEL, let the host go again.
+static void serialResume(void)
+{
+	if ((GPIOR0 & (1<<FLAG_RX_PAUSED)) && (serialCount() <= RX_XON_LEVEL))
+	{
+		cli();
+		GPIOR0 &= ~(1<<FLAG_RX_PAUSED);
+		serialSendNow(XON);
+		sei();
+	}
+}
+
+// Pull the oldest byte out of the receive buffer. Doesn't check for an empty
+//   buffer; that's the caller's job.
+uint8_t serialReadChar(void)
+{
+	uint8_t data = rxBuffer[rxTail];
+	rxTail = (rxTail + 1) & RX_BUFFER_MASK;
+	serialResume();
+	return data;
+}
+
+#ifdef FEATURE_FRAMES
+// Throw away everything in the receive buffer but the oldest keep bytes; no
+//   more than serialCount(). That means pulling rxHead back, which belongs to
+//   the receive ISR, so keep it out while we do.
+void serialTrim(uint8_t keep)
+{
+	uint8_t sreg = SREG;
+	cli();
+	rxHead = (rxTail + keep) & RX_BUFFER_MASK;
+	SREG = sreg;
+	serialResume();
+}
+#endif
 
 // serialWrite() takes a pointer to a string and iterates over that string
-//   until it finds the C end-of-string character ('\0'). It's a blocking
-//   operation and does not return until the print operation is completed.
+//   until it finds the C end-of-string character ('\0'). With
+//   FEATURE_TX_BUFFER, the characters are queued for the UDRE ISR; use
+//   serialFlush() to wait for them to go out.
 void serialWrite(char* data)
 {
 	do
@@ -36,40 +175,70 @@ void serialWrite(char* data)
 	serialNewline();
 }
 
-// Convert a 16-bit unsigned value into ASCII characters and dump it out
-//   to the serial port.
-void serialWriteInt(unsigned int data)
-{	
-	uint8_t tenth = 0;
-	uint8_t thou = 0;
-	uint8_t huns = 0;
-	uint8_t tens = 0;
-	uint8_t ones = 0;
-	// This is an awkward shifting/dividing method of isolating the individual
-	//   digits of the number. I'm sure there's a better way, but done is.
-	tenth = (data/10000);
-	data -= tenth*10000;
-	thou = (uint8_t)(data/1000);
-	data -= (uint16_t)thou*1000;
-	huns = (uint8_t)(data/100);
-	data -= (uint16_t)huns*100;
-	tens = (uint8_t)(data/10);
-	ones = (uint8_t)(data%10);
-	
-	tenth += 48;
-	thou += 48;
-	huns += 48;
-	tens += 48;
-	ones += 48;
-	// Write the individual digits out, followed by a line feed and CR.
-	serialWriteChar(tenth);
-	serialWriteChar(thou);
-	serialWriteChar(huns);
-	serialWriteChar(tens);
-	serialWriteChar(ones);
+// Convert an unsigned value into ASCII characters and dump it out to the
+//   serial port. The tiny has no divide instruction, so rather than dividing
+//   by ten over and over, count how many times each power of ten can be
+//   subtracted off; that's never more than nine per digit. With
+//   SERIAL_LONG, one table serves both widths: 16-bit values start at 10000,
+//   32-bit ones at the top. Both widths go out zero-padded, five digits
+//   or ten, so every field has the one format: a fixed run of digits.
+#ifdef SERIAL_LONG
+typedef uint32_t		decimal_t;
+static const uint32_t	places[] PROGMEM = {1000000000, 100000000, 10000000,
+	1000000, 100000, 10000, 1000, 100, 10};
+#define PLACES_INT		5	// Where the 16-bit values start in places[]
+#define placeRead(p)	pgm_read_dword(p)
+#else
+typedef uint16_t		decimal_t;
+static const uint16_t	places[] PROGMEM = {10000, 1000, 100, 10};
+#define PLACES_INT		0
+#define placeRead(p)	pgm_read_word(p)
+#endif
+
+static void serialWriteDecimal(decimal_t data, uint8_t i)
+{
+	decimal_t	place;
+	char		digit;
+	for (; i < sizeof(places)/sizeof(places[0]); i++)
+	{
+		place = placeRead(&places[i]);
+		digit = '0';
+		while (data >= place)
+		{
+			data -= place;
+			digit++;
+		}
+		serialWriteChar(digit);
+	}
+	// Whatever's left is the ones digit. Follow with a line feed and CR.
+	serialWriteChar('0' + (char)data);
 	serialNewline();
 }
 
+void serialWriteInt(unsigned int data)
+{
+	serialWriteDecimal(data, PLACES_INT);
+}
+
+#if defined(FEATURE_DUMP) || defined(FEATURE_LOG)
+// Two hex digits, no CR/LF, for packing lots of bytes into one line. Just
+//   nibble shifts; no arithmetic to speak of.
+#define hexDigit(n)	((char)((n) < 10 ? '0' + (n) : 'A' - 10 + (n)))
+
+void serialWriteHex(uint8_t data)
+{
+	serialWriteChar(hexDigit(data >> 4));
+	serialWriteChar(hexDigit(data & 0x0F));
+}
+#endif
+
+#ifdef SERIAL_LONG
+void serialWriteLong(uint32_t data)
+{
+	serialWriteDecimal(data, 0);
+}
+#endif
+
 void serialNewline(void)
 {
 	serialWriteChar((char)'\n');
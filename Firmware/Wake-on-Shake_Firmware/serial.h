@@ -13,13 +13,83 @@ Function definitions for the ADXL362.
 #ifndef _serial_h_included
 #define _serial_h_included
 
-void serialWriteChar(char);			// Single character write.
+#define TX_BUFFER_SIZE	8			// Size of the transmit ring buffer, with
+									//  FEATURE_TX_BUFFER. MUST be a power of
+									//  two; the index math depends on it.
+#define TX_BUFFER_MASK	(TX_BUFFER_SIZE - 1)
+#ifdef FEATURE_FRAMES
+#define RX_BUFFER_SIZE	32			// Size of the receive ring buffer. Also
+#define RX_XOFF_LEVEL	16			//  MUST be a power of two. A binary frame
+#else								//  has to fit whole below RX_XOFF_LEVEL
+#define RX_BUFFER_SIZE	16			//  (see FRAME_MAX); ASCII commands are
+#define RX_XOFF_LEVEL	8			//  taken a byte at a time.
+#endif
+#define RX_XON_LEVEL	(RX_XOFF_LEVEL / 2)
+#define RX_BUFFER_MASK	(RX_BUFFER_SIZE - 1)
+
+// The receive ring's indices are used all over, so they're kept in the
+//   spare I/O registers, where they only take IN and OUT to get at.
+#define rxHead			GPIOR1
+#define rxTail			GPIOR2
+
+// Software flow control. The parser blocks while it writes EEPROM or waits
+//   for room to send a reply, and a reply is usually longer than the command
+//   that asked for it, so no buffer is big enough for a host that just keeps
+//   sending. Once RX_XOFF_LEVEL bytes are waiting, the receive ISR sends XOFF;
+//   reading the buffer back down to RX_XON_LEVEL sends XON. That leaves room
+//   for the bytes a host has in flight when XOFF arrives. A host that ignores
+//   XOFF still overruns the buffer; the newest byte in it is then replaced by
+//   RX_OVERRUN, which the ASCII parser rejects, so the command that lost a
+//   byte gets a ":-(" instead of being carried out with the wrong number.
+#define XON				0x11
+#define XOFF			0x13
+#define RX_OVERRUN		0x00
+
+// Flow control bytes can't wait their turn in the transmit buffer, which may
+//   be full of the very reply that's holding things up, so they go straight
+//   into UDR. It frees up within a byte time. Interrupts have to be off, or
+//   the UDRE ISR could load UDR between the check and the write.
+#define serialSendNow(data)	do { while ((UCSRA & (1<<UDRE)) == 0) {} \
+								UDR = (data); } while (0)
+
+// serialWriteLong() is only needed for settings and counters that don't
+//   fit in 16 bits.
+#if defined(FEATURE_LONG_WAKE) || defined(FEATURE_ENERGY) || defined(FEATURE_STATS)
+#define SERIAL_LONG
+#endif
+
+void serialWriteChar(char);			// Single character write. Only blocks
+									//  if the transmit buffer is full (or,
+									//  without FEATURE_TX_BUFFER, until the
+									//  character is sent).
 void serialWrite(char*);			// String constant write. Terminates with a
 									//  a CR and an LF for terminal happiness.
-									//  Blocking.
 void serialWriteInt(unsigned int);  // Convert a 16-bit unsigned value into
 									//  ASCII characters and send it out.
-									//  Terminates with CR and LF. Blocking.
+									//  Terminates with CR and LF.
+void serialWriteLong(uint32_t);		// Same, for 32-bit values; ten digits
+									//  instead of five.
+void serialWriteHex(uint8_t);		// Two hex digits, no CR/LF.
 void serialNewline(void);
+#ifdef FEATURE_TX_BUFFER
+uint8_t serialQueueChar(char);		// Non-blocking single character write.
+									//  Returns FALSE if the buffer is full.
+void serialTxService(void);			// Move one byte from the buffer to the
+									//  USART. Called from the UDRE ISR.
+void serialFlush(void);				// Block until every queued byte has
+									//  left the wire. Call before sleeping!
+#else
+#define serialFlush()				// Nothing is ever left queued.
+#endif
+uint8_t serialAvailable(void);		// TRUE if received data is waiting.
+uint8_t serialCount(void);			// Number of received bytes waiting.
+uint8_t serialPeek(uint8_t);		// Look at a received byte without taking
+									//  it out of the buffer.
+uint8_t serialReadChar(void);		// Pull the oldest received byte out of
+									//  the receive buffer. Check
+									//  serialAvailable() first!
+void serialTrim(uint8_t);			// Throw away everything received but the
+									//  oldest few bytes.
+#define serialDiscard()	serialTrim(0)	// Throw away everything received.
 									
 #endif
@@ -21,13 +21,45 @@ AVR libraries, but maybe I didn't look in the right places.
 //   unlike more advanced processors, the Tinty2313a does not support a
 //   hands-off shift method. The data must be clocked out under software
 //   control!
+// SPI_CLK_LO toggles SCK (rising edge; the ADXL362 samples MOSI), and
+//   SPI_CLK_HI toggles it back and strobes USICLK to shift the data register.
+//   Each is a single OUT instruction. The fastest way is to not loop at all,
+//   so a byte takes 16 cycles and SCK runs at F_CPU/2 (FEATURE_SPI_UNROLLED).
+//   The loop takes about twice as long, in about half the flash.
 uint8_t spiXfer(uint8_t data)
 {
+	uint8_t lo = SPI_CLK_LO;
+	uint8_t hi = SPI_CLK_HI;
+#ifdef FEATURE_SPI_UNROLLED
 	USIDR = data;
-	while ((USISR & (1<<USIOIF)) == 0)
+	USICR = lo;	USICR = hi;		// Bit 7
+	USICR = lo;	USICR = hi;		// Bit 6
+	USICR = lo;	USICR = hi;		// Bit 5
+	USICR = lo;	USICR = hi;		// Bit 4
+	USICR = lo;	USICR = hi;		// Bit 3
+	USICR = lo;	USICR = hi;		// Bit 2
+	USICR = lo;	USICR = hi;		// Bit 1
+	USICR = lo;	USICR = hi;		// Bit 0
+#else
+	uint8_t i;
+	USIDR = data;
+	for (i = 0; i < 8; i++)
 	{
-		USICR = (0<<USIWM1) | (1<<USIWM0) | (1<<USICS1) | (0<<USICS0) | (1<<USICLK) | (1<<USITC);
+		USICR = lo;
+		USICR = hi;
 	}
-	USISR = (1<<USIOIF);
+#endif
 	return USIDR;
+}
+
+// Send len bytes out of buffer, ignoring whatever comes back.
+void spiWriteBlock(uint8_t* buffer, uint8_t len)
+{
+	while (len--) spiXfer(*buffer++);
+}
+
+// Read len bytes into buffer. Zeroes are shifted out while reading.
+void spiReadBlock(uint8_t* buffer, uint8_t len)
+{
+	while (len--) *buffer++ = spiXfer(0);
 }
\ No newline at end of file
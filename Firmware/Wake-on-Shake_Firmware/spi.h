@@ -15,5 +15,15 @@ Function definitions for SPI mode using the USI peripheral.
 
 uint8_t spiXfer(uint8_t);	// 8-bit data transfer function using the onboard
 							//   USI peripheral.
+void spiWriteBlock(uint8_t*, uint8_t);	// Multi-byte write; received data
+										//   is thrown away.
+void spiReadBlock(uint8_t*, uint8_t);	// Multi-byte read.
+
+// USICR values for clocking the USI in three-wire mode (USIWM1:0 = 01) with
+//   no clock source (USICS1:0 = 00), so the data register only shifts when
+//   USICLK is strobed. Writing USITC toggles SCK.
+#define SPI_IDLE	((0<<USIWM1) | (1<<USIWM0) | (0<<USICS1) | (0<<USICS0))
+#define SPI_CLK_LO	(SPI_IDLE | (1<<USITC))
+#define SPI_CLK_HI	(SPI_IDLE | (1<<USITC) | (1<<USICLK))
 
 #endif
\ No newline at end of file
@@ -8,301 +8,715 @@ is that you include attribution of 'Based on Wake-on-Shake by SparkFun'.
 
 ui.cpp
 This file contains implementations of the various user interface functionality.
-Primarily, it contains a very large state machine for parsing data received
-across the serial port into commands.
+Primarily, it contains the table of serial commands and the parser that
+dispatches received data to them.
 ******************************************************************************/
 
 #include<avr/io.h>
-#include "ui.h"
 #include "wake-on-shake.h"
+#include "ui.h"
 #include "eeprom.h"
 #include "serial.h"
 #include "ADXL362.h"
+#include "xl362.h"
+#include "energy.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+extern config_t				config;			// see Wake-on-Shake.cpp
+extern uint16_t				fifoWatermark;	// see Wake-on-Shake.cpp
+extern energyDelta_t			energy;			// see energy.c
+extern uint16_t				t1Start;		// see energy.c
+#ifdef FEATURE_LONG_WAKE
+extern volatile uint16_t	wakeOverflows;	// see Wake-on-Shake.cpp
+#endif
+extern motion_t				motion;			// see Wake-on-Shake.cpp
 
-extern uint16_t				t1Offset;		// see Wake-on-Shake.cpp
-extern volatile uint8_t		serialRxData;	// see Wake-on-Shake.cpp
+static void serialParseChar(uint8_t localData);
+#ifdef FEATURE_FRAMES
+static uint8_t frameParse(void);
+static uint8_t frameWait(uint8_t keep);
+#endif
+#if defined(FEATURE_PEEK) || defined(FEATURE_FRAMES)
+static void eepromPoke(uint8_t addr, uint8_t data);
+#endif
 
-// Probably the most complex part of the code, serialParse() is a state machine
-//   which provides a limited user interface for setting and getting the parameters
-//   which dictate the operation of the Wake-on-shake. It gets called by the main
-//   code whenever a serial interrupt receives a non-null value over the serial
-//   port. It echoes back the received data (primarily for user convenience), then
-//   handles the data depending on current state and received data.
+// serialParse() gets called by the main code whenever there's data sitting in
+//   the serial receive buffer. It drains everything that's there in one go, so
+//   a host can stream a whole script of commands at line rate; the receive
+//   ISR keeps filling the buffer behind us while we work. FRAME_SOF never
+//   shows up in ASCII commands, so it marks the start of a binary frame; if
+//   the rest of the frame isn't here yet, frameParse() leaves it for next
+//   time, unless it's been too long coming (see frameWait()).
 void serialParse(void)
 {
-	// Static variables- these need to persist between calls to this function.
-	
-	// inputBufferValue is the number that the user is currently entering in-
-	//  it could be a threshold value, a delay value, a value to be written
-	//  to the ADXL362 or into EEPROM, or something else. We parse it in by
-	//  multiplying the old value by ten and adding the recently received value
-	//  to the previous value, so we need the current value to persist between
-	//  calls.
-	static uint16_t		inputBufferValue = 0;
-	// mode lets the function know how it should respond to data. In some cases,
-	//   we just want to keep incrementing inputBufferValue; in others, we want
-	//   to take immediate action.
-	static uint8_t		mode = ' ';
-	// serialDataBuffer is used to store a value the user wants to either send
-	//   to the ADXL362 or put into EEPROM. For ease of implementation, we only
-	//   do one byte at a time- first put in the data, then tell the device
-	//   where to send it.
-	static uint8_t		serialDataBuffer = 0;
-	// localData buffers serialRxData. Because of the length of time it can
-	//   take for this function to complete (at 2400 baud, serial writes take
-	//   quite some time, as do EEPROM writes), we want to know that nothing
-	//   has changed between when we enter the function and code we encounter
-	//   further down. The only way to ensure that is to buffer serialRxData
-	//   locally, since serialRxData can be changed by the serial receive ISR
-	//   at any time.
-	uint8_t				localData = serialRxData;
-	
-	serialRxData = 0;					// Clear serialRxData
-	//serialWriteChar(localData);		// Echo received data. Removed from
-										//  released version b/c there's no
-										//  real need to do this.
-	
-// The state machine is implemented as an if/else group.
-	
-// First case: carriage returns/newlines when we're in the "no data" state.
-//   Basically, we can just ignore these. This is important, because we don't
-//   know for sure what the serial program the user is entering data from will
-//   send at the end of the line, so we need to respond to either if they
-//   happen at the end of data entry, and ignore them any other time, since
-//   some programs may send BOTH CR and LF. We also don't want to let this be
-//   the default case, because it would be annoying to see "Invalid input"
-//   every time we enter a value.
-	if (((localData == '\n') | (localData == '\r')) & (mode == ' '));
-	
-// CR/LF when we're in data reading mode: respond to whichever one happens first
-//   by parsing the received data.
-	else if (((localData == '\n') | (localData == '\r')) & (mode != ' '))
+	while (serialAvailable())
 	{
-		// Now, make a decision about what to do with the data depending on the mode.
-		switch(mode)
+#ifdef FEATURE_FRAMES
+		if (serialPeek(0) == FRAME_SOF)
 		{
-			// 't' indicates that user wanted to change the threshold setting, so
-			//   let's store the inputBufferValue in EEPROM and update the value in
-			//   memory. We won't bother updating the ADXL362 just yet; that will
-			//   happen right before we go to sleep.
-			case 't':
-			EEPROMWriteWord((uint8_t)ATHRESH, inputBufferValue);
-			break;
-			// 'd' indicates that user wanted to change the delay before sleep, so
-			//   so we need to convert the user's value in milliseconds to an offset
-			//   value that can be loaded into TCNT1. We'll also include a check so
-			//   the user can't accidentally set the timeout period so short as to
-			//   render the device difficult to program.
-			case 'd':
-			t1Offset = 65535 - inputBufferValue;
-			if (t1Offset > 63535) t1Offset = 63535;
-			EEPROMWriteWord((uint8_t)WAKE_OFFS, t1Offset);
-			break;
-			// 'b' indicates that the user wishes to buffer a value to be written
-			//   to something, either the ADXL362 -or- an EEPROM location in the tiny.
-			case 'b':
-			serialDataBuffer = (uint8_t)inputBufferValue;
-			break;
-			// 'w' indicates that the user wants to write a value directly to the
-			//   ADXL362 part. In this case, inputBufferValue is taken as an
-			//   address to write to, and the data to be written is in the
-			//   serialDataBuffer variable.
-			case 'w':
-			ADXLWriteByte((uint8_t)inputBufferValue, serialDataBuffer);
-			break;
-			// 'r' indicates a desire to read from an address in the ADXL part.
-			//   inputBufferValue provides an address to read from.
-			case 'r':
-			serialWriteInt((uint16_t)ADXLReadByte((uint8_t)inputBufferValue));
-			break;
-			// 'e' directs the device to store the buffered value into the
-			//   address provided by inputBufferValue.
-			case 'e':
-			EEPROMWriteByte((uint8_t)inputBufferValue, serialDataBuffer);
-			break;
-			// 'E' directs the device to return a value stored in the EEPROM
-			//   over the serial port from the address specified.
-			case 'E':
-			serialWriteInt((uint16_t)EEPROMReadByte((uint8_t)inputBufferValue));
-			break;
+			if (frameParse() == FALSE) return;
 		}
-		inputBufferValue = 0;		// Clear the input buffer for next data stream.
-		mode = ' ';					// Reset the mode for next data stream.
-		printMenu();				// Just an indicator of success.
+		else
+#endif
+		serialParseChar(serialReadChar());
+	}
+}
+
+#ifdef FEATURE_PEEK
+// serialDataBuffer is used to store a value the user wants to either send
+//   to the ADXL362 or put into EEPROM. For ease of implementation, we only
+//   do one byte at a time- first put in the data ('b'), then tell the device
+//   where to send it.
+static uint8_t		serialDataBuffer = 0;
+#endif
+
+// Command handlers. Each gets the number the user typed (or, for the pin
+//   commands, the pin's entry from pins[]).
+
+// 't' changes the activity threshold. The new value goes out to the ADXL362
+//   right before we go to sleep.
+static void cmdThreshold(arg_t value)
+{
+	config.athresh = value;
+	configJournal();
+	ADXLMarkDirty();
+}
+
+// 'd' changes the delay before sleep, in milliseconds (well, 1.024ms Timer1
+//   ticks), up to 16 bits' worth, or 32 with FEATURE_LONG_WAKE; 30 minutes
+//   is d1800000. We'll also include a check so the user can't accidentally
+//   set the timeout period so short as to render the device difficult to
+//   program.
+static void cmdDelay(arg_t value)
+{
+	config.wakeTicks = (value < WAKE_MIN) ? WAKE_MIN : value;
+	configJournal();
+}
+
+#ifdef FEATURE_PEEK
+// 'b' buffers a value to be written to something, either the ADXL362 -or-
+//   an EEPROM location in the tiny.
+static void cmdBuffer(arg_t value)
+{
+	serialDataBuffer = (uint8_t)value;
+}
+
+// 'w' writes the buffered value directly to an ADXL362 register. It gets put
+//   back the way the settings say it should be at sleep.
+static void cmdAdxlWrite(arg_t addr)
+{
+	ADXLWriteByte((uint8_t)addr, serialDataBuffer);
+	ADXLMarkDirty();
+}
+
+// 'r' reads an ADXL362 register.
+static void cmdAdxlRead(arg_t addr)
+{
+	serialWriteInt((uint16_t)ADXLReadByte((uint8_t)addr));
+}
+
+// 'e' stores the buffered value into EEPROM.
+static void cmdEepromWrite(arg_t addr)
+{
+	eepromPoke((uint8_t)addr, serialDataBuffer);
+}
+
+// 'E' reads a byte of EEPROM.
+static void cmdEepromRead(arg_t addr)
+{
+	serialWriteInt((uint16_t)EEPROMReadByte((uint8_t)addr));
+}
+#endif
+
+#ifdef FEATURE_ENERGY
+// 'c' prints the energy counters; see energyReport() for what's what. A
+//   value of 1 clears them first.
+static void cmdEnergy(arg_t value)
+{
+	if (value == 1) energyClear();
+	energyReport();
+}
+#endif
+
+#ifdef FEATURE_FIFO
+// 'f' turns FIFO streaming on, with the value as the watermark in samples
+//   (use a multiple of three, to keep XYZ sets together). Zero turns
+//   streaming back off. Streaming stops on its own when the device goes to
+//   sleep. While it's on, the pin change interrupt on INT1 (PD3) is what
+//   gets the main loop out of its nap to send the samples.
+static void cmdFifo(arg_t value)
+{
+	if (value > ADXL_FIFO_MAX) value = ADXL_FIFO_MAX;
+	fifoWatermark = value;
+	if (fifoWatermark == 0)
+	{
+		ADXLFifoStop();
+		GIMSK = 0;
+		PCMSK2 = 0;
 	}
-	
-// If the mode is currently null, and the character entered is a valid mode,
-//   let's activate that mode. In some cases, we want immediate action, and
-//   then to return to null mode.
-	else if ((mode == ' ')&(
-			(localData == 't') |	// Change the threshold setting
-			(localData == 'd') |	// Change the delay before sleep
-			(localData == 'z') |	// Force sleep in ~35ms
-			(localData == 'b') |	// Buffer a byte for EEPROM or ADXL write
-			(localData == 'w') |	// Write buffered byte to ADXL362 register
-			(localData == 'r') |	// Read ADXL362 register
-			(localData == 'e') |	// Write buffered byte to EEPROM address
-			(localData == 'E') |	// Read byte from EEPROM address
-			(localData == 'p') |	// Read pin level (pins on header only)
-			(localData == 'H') |	// Set pin high (pins on header only)
-			(localData == 'L')		// Set pin low (pins on header only)
-			))
+	else
 	{
-		mode = localData;
-		// Most of the time, we need more information from the user. SOMETIMES,
-		//   we may want to take immediate action. ATM, only a 'z' spurs that,
-		//   indicating to the device that we want it to go to sleep post-haste
-		//   and not buffer more data. Future immediate commands should be
-		//   added here.
-	    if (mode == 'z')
-		{
-			TCNT1 = 65500;	// Set TCNT1 to *almost* overflowing. Sleep will
-							//   occur right after an overflow of TCNT1.
-			mode = ' ';		// Clear mode for later.
-		}
+		ADXLFifoStart(fifoWatermark);
+		PCMSK2 = (1<<PCINT14);		// PD3
+		GIMSK = (1<<PCIE2);
+	}
+}
+#endif
+
+#ifdef FEATURE_DUMP
+// 'D' dumps everything in one go: the whole ADXL362 register map in a single
+//   SPI burst on the first line, then all of EEPROM, 32 bytes to a line. It's
+//   all packed hex, two digits per byte, with no addresses; line and column
+//   say where each byte came from.
+static void cmdDump(arg_t unused)
+{
+	uint8_t addr = 0;
+	ADXLReadStream(0, ADXL_REG_COUNT, serialWriteHex);
+	do
+	{
+		if ((addr & 0x1F) == 0) serialNewline();
+		serialWriteHex(EEPROMReadByte(addr));
+	} while (++addr < EEPROM_SIZE);
+	serialNewline();
+}
+#endif
+
+#ifdef FEATURE_LOG
+// 'l' dumps the wake log, in one line of packed hex like 'D'. Each record is
+//   a sequence number, a wakeLog_t (little-endian), and a CRC-8.
+static void cmdLog(arg_t unused)
+{
+	uint8_t addr = LOG_ADDR;
+	do
+	{
+		serialWriteHex(EEPROMReadByte(addr));
+	} while (++addr < LOG_ADDR + LOG_SLOTS*LOG_REC_LEN);
+	serialNewline();
+}
+#endif
+
+#ifdef FEATURE_STATS
+// 'm' sets how often the motion statistics get a sample while awake, as a
+//   code: 0 is off, 1 is ~61Hz, and each step up halves it, to ~4Hz at 5.
+//   It takes effect at the next wake-up. 'M' prints them: the number of
+//   samples, then the peak and sum of squares for X, Y, and Z. RMS is
+//   sqrt(sum / samples); the log has it for the whole wake-up.
+static void cmdStatsRate(arg_t value)
+{
+	if (value > 5) value = 5;
+	config.flags = (config.flags & ~CONFIG_STATS) | (uint8_t)(value << CONFIG_STATS_SHIFT);
+	configSave();
+}
+
+static void cmdStats(arg_t unused)
+{
+	uint8_t axis;
+	serialWriteInt(motion.samples);
+	for (axis = 0; axis < 3; axis++)
+	{
+		serialWriteInt(motion.peak[axis]);
+		serialWriteLong(motion.sumSq[axis]);
+	}
+}
+#endif
+
+#ifdef FEATURE_SENSOR_AWAKE
+// 'k' picks who decides how long a motion wake-up lasts. k0 is the timer,
+//   for the 'd' time. k1 is the ADXL362: the load stays on for as long as the
+//   motion keeps up, and goes off at inactivity (see the inactivity
+//   threshold and time in the config block), with the processor powered
+//   down in between. Wake-ups from serial data always use the timer.
+static void cmdKeepAwake(arg_t value)
+{
+	if (value) config.flags |= CONFIG_SENSOR_AWAKE;
+	else config.flags &= ~CONFIG_SENSOR_AWAKE;
+	configSave();
+}
+#endif
+
+#ifdef FEATURE_POWER_PROFILE
+// The ADXL362 power profile commands all change a field in one of the two
+//   register bytes in the config block. Like 't', the new setting goes out
+//   to the ADXL362 right before we go to sleep.
+static void setField(uint8_t* reg, uint8_t mask, uint8_t value)
+{
+	*reg = (*reg & ~mask) | (value & mask);
+	configSave();
+	ADXLMarkDirty();
+}
+
+// 'o' sets the output data rate: 0 is 12.5Hz, and each step up doubles it,
+//   to 400Hz at 5. Higher rates catch shorter bumps, and cost more current.
+//   This is the rate the sensor runs at while the ADXL362 keeps us awake
+//   ('k1'), and in the full-rate power modes; in wake-up mode it's ~6Hz.
+static void cmdRate(arg_t value)
+{
+	if (value > XL362_RATE_400) value = XL362_RATE_400;
+	setField(&config.filterCtl, 0x07, (uint8_t)value);
+}
+
+// 'g' sets the range, in g: 2, 4, or 8. The thresholds are counted in LSBs,
+//   which are 1mg at 2g, 2mg at 4g, and 4mg at 8g, so they need to be set
+//   again to keep the same sensitivity.
+static void cmdRange(arg_t value)
+{
+	uint8_t range = XL362_RANGE_2G;
+	if (value >= 4) range = XL362_RANGE_4G;
+	if (value >= 8) range = XL362_RANGE_8G;
+	setField(&config.filterCtl, XL362_RANGE_8G | XL362_RANGE_4G, range);
+}
+
+// 'n' sets the noise mode: 0 is normal, 1 low noise, and 2 ultralow noise.
+//   Each step roughly halves the noise, and about doubles the current.
+static void cmdNoise(arg_t value)
+{
+	if (value > 2) value = 2;
+	setField(&config.powerCtl, XL362_LOW_NOISE3, (uint8_t)(value<<4));
+}
+
+// 'a' sets the power mode, as bits: 2 is wake-up mode (the default), where
+//   the ADXL362 only looks for activity ~6 times a second and draws a few
+//   hundred nA; 1 is autosleep, where it samples at the full ODR until it
+//   sees inactivity, then drops to wake-up mode on its own. 0 samples at the
+//   full ODR all the time, for the quickest response.
+static void cmdPowerMode(arg_t value)
+{
+	setField(&config.powerCtl, XL362_SLEEP | XL362_AUTO_SLEEP, (uint8_t)(value<<2));
+}
+#endif
+
+#ifdef FEATURE_CONFIRM
+// 'T' sets the activity time: how many samples, past the first, must be
+//   over the threshold before the ADXL362 calls it activity. It ignores this
+//   in wake-up mode ('a2'), so use 'a0' or 'a1' with it, or 'C'.
+static void cmdActivityTime(arg_t value)
+{
+	config.atime = (value > 255) ? 255 : value;
+	configSave();
+	ADXLMarkDirty();
+}
+
+// 'C' sets the confirm window, in samples; see wakeConfirm(). 0 turns it
+//   off, and the load goes on the moment the ADXL362 sees activity.
+static void cmdConfirm(arg_t value)
+{
+	config.confirm = (value > 255) ? 255 : value;
+	configSave();
+}
+#endif
+
+#ifdef FEATURE_PROFILES
+// 'P' switches to a saved profile, and prints the new threshold and delay;
+//   'S' saves the settings as a profile. Both take a single digit, from 0
+//   to PROFILE_SLOTS - 1. Switching to a slot nothing was saved into
+//   changes nothing.
+static void cmdProfileLoad(arg_t slot)
+{
+	if (profileLoad((uint8_t)slot) == FALSE)
+	{
+		abortInput();
+		return;
+	}
+	ADXLMarkDirty();
+	printConfig();
+}
+
+static void cmdProfileSave(arg_t slot)
+{
+	if (slot >= PROFILE_SLOTS) abortInput();
+	else profileSave((uint8_t)slot);
+}
+#endif
+
+// 'z' wants the device to go to sleep post-haste. Set TCNT1 to *almost*
+//   overflowing; sleep will occur right after an overflow of TCNT1.
+static void cmdSleep(arg_t unused)
+{
+	cli();
+	timer1Load(65500);
+#ifdef FEATURE_LONG_WAKE
+	wakeOverflows = 0;
+#endif
+	sei();
+}
+
+// The pin commands can use PB0:3 and PD6, which are the ones on the header;
+//   pins[] maps the number the user types to the pin's bit mask, plus
+//   PIN_PORTD if it's on port D.
+static const uint8_t pins[] PROGMEM =
+{
+	0x01, 0x02, 0x04, 0x08, PIN_NONE, PIN_NONE, PIN_PORTD | 0x40
+};
+
+// 'p' makes a pin an input and prints its state.
+static void cmdPinRead(arg_t pin)
+{
+	uint8_t	mask = pin & ~PIN_PORTD;
+	uint8_t	level;
+	if (pin & PIN_PORTD)
+	{
+		DDRD &= ~mask;
+		level = PIND;
+	}
+	else
+	{
+		DDRB &= ~mask;
+		level = PINB;
 	}
-// Mode handler. Depending on the mode, the current input character should
-//   be handled differently. Code for handling what happens before a user
-//   has finished inputting a number goes here.
-	else if (	(mode == 't')|\
-				(mode == 'd')|\
-				(mode == 'w')|\
-				(mode == 'r')|\
-				(mode == 'e')|\
-				(mode == 'E')|\
-				(mode == 'p')|\
-				(mode == 'H')|\
-				(mode == 'L')|\
-				(mode == 'b'))
+	serialWriteChar((level & mask) ? '1' : '0');
+}
+
+// 'H' and 'L' make a pin an output, and drive it high or low.
+static void pinDrive(uint8_t pin, uint8_t high)
+{
+	uint8_t	mask = pin & ~PIN_PORTD;
+	uint8_t	set = high ? mask : 0;
+	mask = ~mask;
+	if (pin & PIN_PORTD)
+	{
+		DDRD |= ~mask;
+		PORTD = (PORTD & mask) | set;
+	}
+	else
+	{
+		DDRB |= ~mask;
+		PORTB = (PORTB & mask) | set;
+	}
+}
+
+static void cmdPinHigh(arg_t pin)
+{
+	pinDrive(pin, TRUE);
+}
+
+static void cmdPinLow(arg_t pin)
+{
+	pinDrive(pin, FALSE);
+}
+
+// The command table, in flash. Adding a command is adding a row. What
+//   happens after the command letter depends on the argument kind:
+//     ARG_NONE: nothing; the handler runs right away.
+//     ARG_NUMBER: digits, then CR or LF (we don't know for sure which the
+//       user's terminal sends). The handler gets the number, then we print
+//       the menu as a sign of success.
+//     ARG_PIN: a single pin digit; no CR/LF needed.
+//     ARG_DIGIT: a single digit; no CR/LF needed.
+static const command_t commands[] PROGMEM =
+{
+	{ 't', ARG_NUMBER,	cmdThreshold },		// Change the threshold setting
+	{ 'd', ARG_NUMBER,	cmdDelay },			// Change the delay before sleep
+	{ 'z', ARG_NONE,	cmdSleep },			// Force sleep in ~35ms
+#ifdef FEATURE_PEEK
+	{ 'b', ARG_NUMBER,	cmdBuffer },		// Buffer a byte for EEPROM or ADXL write
+	{ 'w', ARG_NUMBER,	cmdAdxlWrite },		// Write buffered byte to ADXL362 register
+	{ 'r', ARG_NUMBER,	cmdAdxlRead },		// Read ADXL362 register
+	{ 'e', ARG_NUMBER,	cmdEepromWrite },	// Write buffered byte to EEPROM address
+	{ 'E', ARG_NUMBER,	cmdEepromRead },	// Read byte from EEPROM address
+#endif
+#ifdef FEATURE_ENERGY
+	{ 'c', ARG_NUMBER,	cmdEnergy },		// Energy counters
+#endif
+#ifdef FEATURE_FIFO
+	{ 'f', ARG_NUMBER,	cmdFifo },			// Stream the ADXL362 FIFO
+#endif
+#ifdef FEATURE_SENSOR_AWAKE
+	{ 'k', ARG_NUMBER,	cmdKeepAwake },		// Timer or ADXL362 keeps us awake
+#endif
+#ifdef FEATURE_POWER_PROFILE
+	{ 'o', ARG_NUMBER,	cmdRate },			// ADXL362 output data rate
+	{ 'g', ARG_NUMBER,	cmdRange },			// ADXL362 range
+	{ 'n', ARG_NUMBER,	cmdNoise },			// ADXL362 noise mode
+	{ 'a', ARG_NUMBER,	cmdPowerMode },		// ADXL362 wake-up/autosleep mode
+#endif
+#ifdef FEATURE_CONFIRM
+	{ 'T', ARG_NUMBER,	cmdActivityTime },	// ADXL362 activity time
+	{ 'C', ARG_NUMBER,	cmdConfirm },		// Samples to confirm motion wake-ups
+#endif
+#ifdef FEATURE_PROFILES
+	{ 'P', ARG_DIGIT,	cmdProfileLoad },	// Switch to a saved profile
+	{ 'S', ARG_DIGIT,	cmdProfileSave },	// Save the settings as a profile
+#endif
+#ifdef FEATURE_DUMP
+	{ 'D', ARG_NONE,	cmdDump },			// Dump ADXL362 registers and EEPROM
+#endif
+#ifdef FEATURE_LOG
+	{ 'l', ARG_NONE,	cmdLog },			// Dump the wake log
+#endif
+#ifdef FEATURE_STATS
+	{ 'm', ARG_NUMBER,	cmdStatsRate },		// Motion statistics sample rate
+	{ 'M', ARG_NONE,	cmdStats },			// Print the motion statistics
+#endif
+	{ 'p', ARG_PIN,		cmdPinRead },		// Read pin level (pins on header only)
+	{ 'H', ARG_PIN,		cmdPinHigh },		// Set pin high (pins on header only)
+	{ 'L', ARG_PIN,		cmdPinLow },		// Set pin low (pins on header only)
+};
+#define COMMAND_COUNT	(sizeof(commands) / sizeof(commands[0]))
+
+// serialParseChar() provides a limited user interface for setting and getting
+//   the parameters which dictate the operation of the Wake-on-shake. It gets
+//   called by serialParse() once for each byte received over the serial
+//   port. The only state is which command (if any) is in progress, and the
+//   number typed so far, so every byte costs about the same to handle; only
+//   a command letter has to be looked up in the table.
+static void serialParseChar(uint8_t localData)
+{
+	// command is the table entry for the command in progress, or NULL when
+	//   we're waiting for a new one. inputBufferValue is the number the user
+	//   is typing in; each digit multiplies the old value by ten and adds
+	//   itself on.
+	static const command_t*	command = NULL;
+	static arg_t			inputBufferValue = 0;
+	handler_t				handler;
+	uint8_t					i;
+
+	if (command == NULL)
 	{
-		// case 'p': indicates user wants to print out the state of a given
-		//   pin. Pins available for this are PB0:3 and PD6; we'll respond
-		//   based on a numerical input 0-3 or 6. Other values print an
-		//   error message. Note that no cr/lf is needed to complete this
-		//   operation- it just...ends, as soon as another character has
-		//   been received.
-		if (mode == 'p')
+		// Line endings between commands are just ignored, since some
+		//   terminals send both CR and LF.
+		if ((localData == '\n') || (localData == '\r')) return;
+		for (i = 0; i < COMMAND_COUNT; i++)
 		{
-			mode = ' ';   // clear mode. We'll do this regardless of outcome.
-			switch(localData)
+			if (pgm_read_byte(&commands[i].op) == localData)
 			{
-				case '0':
-				DDRB &= ~(1<<PB0);							// make pin input
-				serialWriteChar('0'+((PINB & (1<<PB0))>>PB0));    // isolate bit and
-														    //   read it out
-				break;
-				case '1':
-				DDRB &= ~(1<<PB1);
-				serialWriteChar('0'+((PINB & (1<<PB1))>>PB1));
-				break;
-				case '2':
-				DDRB &= ~(1<<PB2);
-				serialWriteChar('0'+((PINB & (1<<PB2))>>PB2));
-				break;
-				case '3':
-				DDRB &= ~(1<<PB3);
-				serialWriteChar('0'+((PINB & (1<<PB3))>>PB3));
-				break;
-				case '6':
-				DDRD &= ~(1<<PD6);
-				serialWriteChar('0'+((PIND & (1<<PD6))>>PD6));
-				break;
-				default:
-				abortInput();
+				command = &commands[i];
 				break;
 			}
 		}
-		// case 'H': indicates user wants to set the state of a given pin to
-		//   high. Pins available for this are PB0:3 and PD6; we'll respond
-		//   based on a numerical input 0-3 or 6. Other values print an
-		//   error message.
-		else if (mode == 'H')
+		if (command == NULL)
 		{
-			mode = ' ';   // clear mode. We'll do this regardless of outcome.
-			switch(localData)
-			{
-				case '0':
-				DDRB |= (1<<PB0);	// make pin an output
-				PORTB |= (1<<PB0);  // set pin high
-				break;
-				case '1':
-				DDRB |= (1<<PB1);
-				PORTB |= (1<<PB1);
-				break;
-				case '2':
-				DDRB |= (1<<PB2);
-				PORTB |= (1<<PB2);
-				break;
-				case '3':
-				DDRB |= (1<<PB3);
-				PORTB |= (1<<PB3);
-				break;
-				case '6':
-				DDRD |= (1<<PD6);
-				PORTD |= (1<<PD6);
-				break;
-				default:
-				abortInput();
-				break;
-			}
+			abortInput();
+			return;
+		}
+		inputBufferValue = 0;
+		if (pgm_read_byte(&command->kind) != ARG_NONE) return;
+	}
+
+	handler = (handler_t)pgm_read_word(&command->handler);
+	switch (pgm_read_byte(&command->kind))
+	{
+		case ARG_NUMBER:
+		if (('0' <= localData) && (localData <= '9'))
+		{
+			inputBufferValue = inputBufferValue*10 + (localData - '0');
+			return;
+		}
+		if ((localData == '\n') || (localData == '\r'))
+		{
+			handler(inputBufferValue);
+			printMenu();		// Just an indicator of success.
 		}
-		// case 'L': indicates user wants to set the state of a given pin to
-		//   low. Pins available for this are PB0:3 and PD6; we'll respond
-		//   based on a numerical input 0-3 or 6. Other values print an
-		//   error message.
-		else if (mode == 'L')
+		else abortInput();		// Whine a bit so they know they screwed up.
+		break;
+
+#ifdef FEATURE_PROFILES
+		case ARG_DIGIT:
+		i = localData - '0';
+		if (i > 9) abortInput();
+		else handler(i);
+		break;
+#endif
+
+		case ARG_PIN:
+		i = localData - '0';
+		i = (i < sizeof(pins)) ? pgm_read_byte(&pins[i]) : PIN_NONE;
+		if (i == PIN_NONE) abortInput();
+		else handler(i);
+		break;
+
+		default:
+		handler(inputBufferValue);
+		break;
+	}
+	command = NULL;				// Ready for the next command.
+}
+
+#if defined(FEATURE_PEEK) || defined(FEATURE_FRAMES)
+// Write a byte of EEPROM. Writes into the config block go through the RAM
+//   copy, so the CRC stays good and the new setting takes effect.
+static void eepromPoke(uint8_t addr, uint8_t data)
+{
+	if (addr < CONFIG_LEN)
+	{
+		((uint8_t*)&config)[addr] = data;
+		configSave();
+		ADXLMarkDirty();
+	}
+	else EEPROMWriteByte(addr, data);
+}
+#endif
+
+#ifdef FEATURE_FRAMES
+// Binary frames let a host do a whole batch of reads and writes in one round
+//   trip, instead of a line (and a ":-)") apiece. A frame is:
+//     FRAME_SOF, length, payload (length bytes), CRC-8 of length and payload
+//   and the payload is any number of operations, each an opcode, a starting
+//   address, and a count n:
+//     'r' addr n			read n ADXL362 registers
+//     'w' addr n data...	write n ADXL362 registers
+//     'E' addr n			read n bytes of EEPROM
+//     'e' addr n data...	write n bytes of EEPROM
+//   The whole frame gets checked before any of it is carried out. The answer
+//   is one frame back:
+//     FRAME_SOF, length, status, everything read (in order), CRC-8
+//   where the CRC covers everything after FRAME_SOF. The frame is parsed
+//   right out of the receive buffer, so the whole thing has to fit in there
+//   without tripping XOFF; that's what limits the payload to FRAME_MAX
+//   bytes. As with the ASCII commands, the byte that wakes the part up is
+//   lost, so send something else first if it might be asleep. A length that
+//   can't be right leaves no way to tell where the frame ends, so everything
+//   after it is thrown out until the host goes quiet; then the answer is a
+//   FRAME_BAD_LENGTH reply. Otherwise, the rest of the payload would get
+//   taken for ASCII commands.
+
+// Send a byte of the reply, and add it to the CRC.
+static uint8_t frameSend(uint8_t crc, uint8_t data)
+{
+	serialWriteChar((char)data);
+	return crc8Update(crc, data);
+}
+
+// A frame that stops partway (a dropped byte, or a host that gave up) would
+//   sit at the front of the receive buffer for good, and keep the main code
+//   from napping. The receive ISR reloads Timer1 on every byte, so the time
+//   since the last one is TCNT1 - t1Start; once that reaches FRAME_TIMEOUT,
+//   throw out everything received but the oldest keep bytes, and return TRUE.
+//   Until then, point Timer1's compare match at the deadline, and set
+//   FLAG_FRAME_WAIT so the main code can nap; the next byte or the compare
+//   match clears the flag, and we look again. Both Timer1 values change in
+//   ISRs, so read them with interrupts off.
+static uint8_t frameWait(uint8_t keep)
+{
+	uint8_t		late;
+	cli();
+	late = ((uint16_t)(TCNT1 - t1Start) >= FRAME_TIMEOUT);
+	if (late) serialTrim(keep);
+	else
+	{
+		OCR1A = t1Start + FRAME_TIMEOUT;
+		GPIOR0 |= (1<<FLAG_FRAME_WAIT);
+	}
+	sei();
+	return late;
+}
+
+// Returns FALSE if the frame hasn't all arrived yet, or one with a bad length
+//   is still coming in; see frameWait().
+static uint8_t frameParse(void)
+{
+	uint8_t		len;
+	uint8_t		crc = CRC8_INIT;
+	uint8_t		status = FRAME_OK;
+	uint16_t	reply = 1;		// Reply length: the status, plus reads.
+	uint8_t		i;
+	uint8_t		op;
+	uint8_t		addr;
+	uint8_t		n;
+
+	if (serialCount() < 2) return frameWait(0);
+	len = serialPeek(1);
+	if ((len == 0) || (len > FRAME_MAX))
+	{
+		// Keep FRAME_SOF and the length for next time, and drop the rest as
+		//   it comes in, until the host stops sending.
+		serialTrim(2);
+		if (frameWait(2) == FALSE) return FALSE;
+		len = 0;
+		status = FRAME_BAD_LENGTH;
+	}
+	else
+	{
+		if (serialCount() < len + 3) return frameWait(0);
+		for (i = 1; i < len + 2; i++) crc = crc8Update(crc, serialPeek(i));
+		if (crc != serialPeek(len + 2)) status = FRAME_BAD_CRC;
+		// Make sure every operation is whole, and work out the reply size.
+		for (i = 2; (status == FRAME_OK) && (i < len + 2); i += 3)
+		{
+			op = serialPeek(i);
+			n = serialPeek(i + 2);
+			if (i + 3 > len + 2) status = FRAME_BAD_OP;
+			else if ((op == 'r') || (op == 'E')) reply += n;
+			else if (((op == 'w') || (op == 'e')) && (n <= len)) i += n;
+			else status = FRAME_BAD_OP;
+		}
+		if ((status == FRAME_OK) && ((i != len + 2) || (reply > 255))) status = FRAME_BAD_OP;
+	}
+
+	serialReadChar();			// FRAME_SOF
+	serialReadChar();			// Length
+	if (status != FRAME_OK)
+	{
+		while (len-- != 0) serialReadChar();
+		if (status != FRAME_BAD_LENGTH) serialReadChar();	// CRC
+		reply = 1;
+	}
+	serialWriteChar((char)FRAME_SOF);
+	crc = frameSend(CRC8_INIT, (uint8_t)reply);
+	crc = frameSend(crc, status);
+	if (status != FRAME_OK) len = 0;
+
+	while (len != 0)
+	{
+		op = serialReadChar();
+		addr = serialReadChar();
+		n = serialReadChar();
+		len -= 3;
+		if ((op == 'w') || (op == 'e')) len -= n;
+		for (; n != 0; n--, addr++)
 		{
-			mode = ' ';   // clear mode. We'll do this regardless of outcome.
-			switch(localData)
+			switch (op)
 			{
-				case '0':
-				DDRB |= (1<<PB0);	// make pin an output
-				PORTB &= ~(1<<PB0); // set pin low
-				break;
-				case '1':
-				DDRB |= (1<<PB1);
-				PORTB &= ~(1<<PB1);
-				break;
-				case '2':
-				DDRB |= (1<<PB2);
-				PORTB &= ~(1<<PB2);
+				case 'r':
+				crc = frameSend(crc, ADXLReadByte(addr));
 				break;
-				case '3':
-				DDRB |= (1<<PB3);
-				PORTB &= ~(1<<PB3);
+				case 'E':
+				crc = frameSend(crc, EEPROMReadByte(addr));
 				break;
-				case '6':
-				DDRD |= (1<<PD6);
-				PORTD &= ~(1<<PD6);
+				case 'w':
+				ADXLWriteByte(addr, serialReadChar());
+				ADXLMarkDirty();
 				break;
-				default:
-				abortInput();
+				case 'e':
+				eepromPoke(addr, serialReadChar());
 				break;
 			}
 		}
-		// Case numeric value AND some other state not involving pins-
-		//   store the value into input buffer.
-		else if (('0' <= localData) & (localData <= '9'))
-		{
-			inputBufferValue *= 10;
-			inputBufferValue += (localData - '0');
-		}
-		// Case ANYTHING ELSE entered by user- clear mode, and whine a bit
-		//   so they know the screwed up.
-		else
+	}
+	if (status == FRAME_OK) serialReadChar();	// CRC
+	serialWriteChar((char)crc);
+	return TRUE;
+}
+#endif
+
+#ifdef FEATURE_FIFO
+// fifoStream() gets called by the main code while streaming is on and the
+//   ADXL362 is pulling INT1 low to say the FIFO watermark has been reached.
+//   It burst-reads everything in the FIFO and sends it out raw- two bytes per
+//   sample, low byte first, as the ADXL362 has them: bits 15:14 say which
+//   axis it is (0=X, 1=Y, 2=Z, 3=temperature), and 13:0 are the
+//   sign-extended data. The host decodes that, and keeps track of which
+//   sample is which. There's no way we could keep up at 9600 baud printing
+//   samples out in human format.
+void fifoStream(void)
+{
+	uint16_t	samples[FIFO_CHUNK];
+	uint16_t	entries = ADXLFifoEntries();
+	uint8_t		chunk;
+	uint8_t		i;
+	while (entries != 0)
+	{
+		chunk = (entries > FIFO_CHUNK) ? FIFO_CHUNK : (uint8_t)entries;
+		ADXLFifoRead(samples, chunk);
+		entries -= chunk;
+		for (i = 0; i < chunk; i++)
 		{
-			mode = ' ';
-			abortInput();
+			serialWriteChar((char)samples[i]);
+			serialWriteChar((char)(samples[i]>>8));
 		}
 	}
-	
-// Otherwise, just ignore what's happening and go back to null mode.
-	else 
-	{
-		mode = ' ';
-		abortInput();
-	}		
 }
+#endif
 
 // Because of the nature of the processor, strings constants use up a 
 //   disproportionate amount of flash memory. Therefore, it makes sense to 
@@ -18,5 +18,40 @@ void serialParse(void);		// This function parses user input data from the
 							//   processor.
 void printMenu(void);		// Prints the string "Ready!". That's the menu.
 void abortInput(void);		// Prints the string "Bad input!".
+void fifoStream(void);		// Dumps the ADXL362 FIFO out the serial port.
+
+// Serial command table; see commands[] in ui.c. Each row is the command
+//   letter, what kind of argument follows it, and the function that does the
+//   work. Numbers typed in are as wide as the awake time; see ticks_t.
+typedef ticks_t arg_t;
+typedef void (*handler_t)(arg_t);
+typedef struct
+{
+	char		op;
+	uint8_t		kind;
+	handler_t	handler;
+} command_t;
+#define ARG_NONE			0		// Runs as soon as the letter arrives.
+#define ARG_NUMBER			1		// Decimal number, ended by CR or LF.
+#define ARG_PIN				2		// One pin digit; see pins[] in ui.c.
+#define ARG_DIGIT			3		// One digit, no CR/LF.
+
+#define PIN_PORTD			0x80	// pins[] flag: bit is on port D, not B.
+#define PIN_NONE			0		// pins[] entry for a digit with no pin.
+
+// Binary frames; see frameParse() in ui.c.
+#define FRAME_SOF			0xA5	// Start of frame. Not ASCII, on purpose.
+#define FRAME_MAX			(RX_XOFF_LEVEL - 4)		// Longest payload. A whole
+									//   frame mustn't trip XOFF, or the host
+									//   would stall partway through it.
+#define FRAME_TIMEOUT		50		// Timer1 ticks (~1ms) to wait for the next
+									//   byte of a frame before giving up on it.
+#define FRAME_OK			0		// Reply status values.
+#define FRAME_BAD_CRC		1
+#define FRAME_BAD_OP		2
+#define FRAME_BAD_LENGTH	3
+
+#define FIFO_CHUNK	6		// Samples per FIFO burst read in fifoStream().
+							//   Two XYZ sets; costs 12 bytes of stack.
 
 #endif /* UI_H_ */
\ No newline at end of file
@@ -15,10 +15,146 @@ functions in other places.
 #ifndef _wake_on_shake_h_included
 #define _wake_on_shake_h_included
 	  
-void EEPROMRetrieve(void);	// Pulls config values out of EEPROM and displays.
-void EEPROMConfig(void);	// Set the EEPROM storage locations up if they
-							//   aren't already configured.
+// Optional features are turned on with FEATURE_ defines; see FEATURES in the
+//   Makefile. The wake log takes its timestamps from the energy counters, and
+//   the rest from the motion statistics.
+#if defined(FEATURE_LOG) && !(defined(FEATURE_ENERGY) && defined(FEATURE_STATS))
+#error "FEATURE_LOG needs FEATURE_ENERGY and FEATURE_STATS"
+#endif
+
+// Awake times are in Timer1 ticks (~ms). 16 bits is a bit over a minute;
+//   FEATURE_LONG_WAKE makes it 32, for up to ~50 days.
+#ifdef FEATURE_LONG_WAKE
+typedef uint32_t	ticks_t;
+#define TICKS_LEN	4		// sizeof(ticks_t), for #if.
+#else
+typedef uint16_t	ticks_t;
+#define TICKS_LEN	2
+#endif
+
+// All the user settings live in one packed block, which is stored in EEPROM
+//   exactly as it sits in RAM (so, little-endian), followed by a CRC-8 of the
+//   rest of the block. It gets read once at boot; after that, everybody uses
+//   the copy in RAM.
+typedef struct
+{
+	ticks_t		wakeTicks;	// Time to stay awake, in Timer1 ticks (~ms).
+	uint16_t	athresh;	// Activity threshold, in LSBs (1mg at 2g).
+							//   These two are also kept in the journal, so
+							//   they must stay together, in this order.
+	uint8_t		atime;		// Activity time, in samples past the first.
+	uint16_t	ithresh;	// Inactivity threshold, in LSBs, like athresh.
+	uint16_t	itime;		// Inactivity time, in samples.
+							//   athresh through itime are ADXL362 registers
+							//   0x20 to 0x26, in order, so ADXLSync() can
+							//   send them straight from here.
+	uint8_t		filterCtl;	// ADXL362 FILTER_CTL: range, and ODR.
+	uint8_t		powerCtl;	// ADXL362 POWER_CTL: noise, wake-up and
+							//   autosleep bits. See the 'o', 'g', 'n' and
+							//   'a' commands. These two are registers 0x2C
+							//   and 0x2D.
+	uint8_t		flags;		// CONFIG_ flags; see below.
+	uint8_t		confirm;	// Samples to check for motion ourselves after an
+							//   ADXL362 wake-up, before the load goes on;
+							//   zero turns that off. See wakeConfirm().
+	uint8_t		crc;		// CRC-8 of everything above. Keep this last!
+} __attribute__((packed)) config_t;
+
+void configLoad(void);		// Pull the config block out of EEPROM, falling
+							//   back to defaults if it's not valid.
+void configSave(void);		// Store the config block (and a fresh CRC).
+#ifdef FEATURE_JOURNAL
+void configJournal(void);	// Store the threshold and delay in the journal.
+#else
+#define configJournal()	configSave()	// No journal; just the block.
+#endif
+void configDefaults(void);	// Set the config block to factory defaults.
+uint8_t profileLoad(uint8_t);	// Switch to a saved profile.
+void profileSave(uint8_t);	// Save the settings as a profile.
+uint8_t wakeConfirm(void);	// Check that motion keeps up for a while after
+							//   an ADXL362 wake-up.
+void printConfig(void);		// Display the threshold and delay settings.
+
+// The EEPROM is shared out in this order: the config block, then the
+//   regions for the journal, the saved profiles, the energy counters, and
+//   the wake log, each starting where the one before ends, so a feature
+//   that's off takes no space. See the checks in eeprom.c.
+#define CONFIG_ADDR	0		// EEPROM address of the config block. It must
+							//   end before JOURNAL_ADDR (see eeprom.h).
+#define CONFIG_LEN	(TICKS_LEN + 12)	// sizeof(config_t), for #if.
+
+// config.flags bits.
+#define CONFIG_SENSOR_AWAKE	0x01	// Motion wake-ups last until the ADXL362
+									//   sees inactivity, instead of for
+									//   wakeTicks. See the 'k' command.
+#define CONFIG_STATS		0x0E	// Motion statistics sample rate code;
+#define CONFIG_STATS_SHIFT	1		//   see statsStart() and 'm'.
+// Saved profiles: whole config blocks, CRC and all, one after another
+//   after the journal. See profileLoad(). They get the EEPROM that the
+//   energy counters and a LOG_MIN_SLOTS wake log (if those are on) leave
+//   free, up to the ten that a digit can pick; the wake log then takes
+//   whatever is left over after them.
+#define PROFILE_ADDR	JOURNAL_END
+#define PROFILE_MAX		10
+#ifdef FEATURE_LOG
+#define PROFILE_FREE	(KEY_ADDR - PROFILE_ADDR - ENERGY_SPACE - LOG_MIN_SLOTS*LOG_REC_LEN)
+#else
+#define PROFILE_FREE	(KEY_ADDR - PROFILE_ADDR - ENERGY_SPACE)
+#endif
+#define PROFILE_SLOTS	((PROFILE_FREE / CONFIG_LEN > PROFILE_MAX) ? PROFILE_MAX : PROFILE_FREE / CONFIG_LEN)
+#ifdef FEATURE_PROFILES
+#define PROFILE_END		(PROFILE_ADDR + PROFILE_SLOTS*CONFIG_LEN)
+#else
+#define PROFILE_END		PROFILE_ADDR
+#endif
+
+// The wake log: a ring (see ringWrite() in eeprom.c) of one record per
+//   wake-up, written as we go back to sleep. It comes after the energy
+//   counters, and gets as many slots as fit from there up to KEY_ADDR; the
+//   compile stops if that's fewer than LOG_MIN_SLOTS. The 'l' command dumps
+//   it; records come out in slot order, so sort them by sequence number.
+typedef struct
+{
+	uint16_t	time;		// When we went back to sleep, in ~1 minute units
+							//   since the energy counters were cleared.
+	uint8_t		source;		// What woke us up; LOG_ values below.
+	uint16_t	peak;		// Most motion seen while awake, in LSBs away from
+							//   the rest position, on the worst axis.
+	uint16_t	rms;		// RMS of the same, over all three axes.
+} __attribute__((packed)) wakeLog_t;
 
+#define LOG_ADDR		ENERGY_END
+#define LOG_REC_LEN		(7 + 2)	// sizeof(wakeLog_t), plus sequence and CRC.
+#define LOG_SLOTS		((KEY_ADDR - LOG_ADDR) / LOG_REC_LEN)
+#define LOG_MIN_SLOTS	3		// Fewer than this isn't much of a log.
+#ifdef FEATURE_LOG
+#define LOG_END			(LOG_ADDR + LOG_SLOTS*LOG_REC_LEN)
+#else
+#define LOG_END			LOG_ADDR
+#endif
+
+// wakeLog_t.source values.
+#define LOG_BOOT		0	// Power-up.
+#define LOG_SERIAL		1	// Serial data (INT0).
+#define LOG_MOTION		2	// The ADXL362 (INT1).
+#define LOG_REJECTED	3	// The ADXL362, but wakeConfirm() said no.
+
+// Motion statistics for the current wake-up, in LSBs away from where the
+//   board sat when it went to sleep. See motionSample().
+typedef struct
+{
+	uint16_t	peak[3];	// Largest move on X, Y, and Z.
+	uint32_t	sumSq[3];	// Sum of the squares of the moves.
+	uint16_t	samples;	// Samples that went into the sums.
+} motion_t;
+
+#define WAKE_MIN	2000	// Shortest awake time 'd' will set, so the part
+							//   can't drop back to sleep before it can be
+							//   reprogrammed.
+
+// Before the config block existed, settings were stored big-endian at these
+//   addresses, and KEY at KEY_ADDR marked them as valid. With
+//   FEATURE_MIGRATE, configLoad() uses these to carry old settings over, once.
 #define ATHRESH		0		// EEPROM address for the activity threshold.
 #define WAKE_OFFS	2		// EEPROM address for the wake offset.
 #define ITHRESH		4		// EEPROM address for the inactivity threshold.
@@ -27,10 +163,52 @@ void EEPROMConfig(void);	// Set the EEPROM storage locations up if they
 #define KEY         123		// EEPROM configuration key value.
 
 // Macros for turning the load on and off.
-#define loadOff() PORTD &= !(1<<PD4)
+#define loadOff() PORTD &= ~(1<<PD4)
 #define loadOn()  PORTD |= (1<<PD4)
 
+// With FEATURE_WAKE_MARK, PB0 on the header goes high first thing in the
+//   INT0/INT1 ISRs, and low again along with the load. On a scope, the time
+//   from the ADXL362's INT1 (PD3) falling to PB0 rising is the wake-up
+//   latency on the board itself; PD4 follows two cycles later. The pin
+//   commands shouldn't be used on PB0 with this on.
+#ifdef FEATURE_WAKE_MARK
+#define wakeMarkOn()	PORTB |= (1<<PB0)
+#define wakeMarkOff()	PORTB &= ~(1<<PB0)
+#else
+#define wakeMarkOn()
+#define wakeMarkOff()
+#endif
+
+// While we're awake, only the naps in the main loop (FEATURE_NAP, or while
+//   streaming the FIFO) and wakeConfirm() sleep, and they want Idle mode, so
+//   Timer1 keeps running. Without any of them, the sleep mode can just stay
+//   at Power Down.
+#if defined(FEATURE_NAP) || defined(FEATURE_CONFIRM) || defined(FEATURE_FIFO)
+#define sleepModeAwake()	set_sleep_mode(SLEEP_MODE_IDLE)
+#define sleepModeAsleep()	set_sleep_mode(SLEEP_MODE_PWR_DOWN)
+#else
+#define sleepModeAwake()
+#define sleepModeAsleep()
+#endif
+
 #define TRUE 1
 #define FALSE 0
+#define SENSOR_AWAKE 2		// sleepyTime value while the ADXL362 is deciding
+							//   how long we stay awake.
+
+// GPIOR0 is a spare I/O register low enough for sbi/cbi, so a flag bit kept
+//   there can be set by the main code and cleared by an ISR without a race.
+#define FLAG_FRAME_WAIT	0	// A partial binary frame is waiting for its next
+							//   byte; see frameWait() in ui.c.
+#define FLAG_ADXL_DIRTY	1	// The settings have changed since the ADXL362
+							//   was last told; see ADXLSync().
+#define FLAG_STATS_DUE	2	// Time for a motion sample; set by the Timer0
+							//   ISR. See statsStart().
+#define FLAG_TX_ACTIVE	3	// A byte has been queued since the last
+							//   serialFlush().
+#define FLAG_SLEEP_CLOCK 4	// The watchdog is counting power-down time;
+							//   see energySleep().
+#define FLAG_RX_PAUSED	5	// XOFF has gone out, and XON hasn't yet; see
+							//   serial.h.
 
 #endif